@@ -0,0 +1,96 @@
+#pragma once
+
+#include "CPUNeuralNet.h"
+#include "InferenceModel.h"
+
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+const int IMAGE_SIZE = 28;
+
+inline double secondsSince(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Noisy copies of ten fixed class templates, enough structure for training to do real work.
+ * Each pixel keeps its template value with probability signal and is uniform noise otherwise,
+ * lower values make the classes harder to tell apart. The templates never change, the seed
+ * only selects the samples, so different seeds give training and test sets of the same problem.
+*/
+inline void makeImages(std::vector<byte>& images, std::vector<byte>& labels, int numImages, uint32_t seed = 1, float signal = 1.0f)
+{
+	const int size = IMAGE_SIZE * IMAGE_SIZE;
+
+	std::mt19937 templateGenerator(1);
+	std::vector<byte> templates(10 * size);
+	for(byte& value : templates)
+	{
+		value = (templateGenerator() % 4 == 0) ? 0 : 255;
+	}
+
+	std::mt19937 generator(seed);
+	images.resize((size_t)numImages * size);
+	labels.resize(numImages);
+
+	for(int i = 0; i < numImages; ++i)
+	{
+		int label = generator() % 10;
+		labels[i] = (byte)label;
+
+		for(int j = 0; j < size; ++j)
+		{
+			if(signal < 1.0f && generator() >= signal * generator.max())
+			{
+				images[(size_t)i * size + j] = (byte)(generator() % 256);
+				continue;
+			}
+
+			int noise = (int)(generator() % 64) - 32;
+			images[(size_t)i * size + j] = (byte)std::min(255, std::max(0, templates[label * size + j] + noise));
+		}
+	}
+}
+
+/**
+ * Mean natural-log cross-entropy and accuracy of a model over the given images
+*/
+inline void evaluate(const std::shared_ptr<const InferenceModel>& model, const std::vector<byte>& images, const std::vector<byte>& labels,
+	int count, float& cost, float& accuracy)
+{
+	InferenceContext context(model);
+	const int size = model->getInputSize();
+
+	double totalCost = 0.0;
+	int numCorrect = 0;
+
+	for(int i = 0; i < count; ++i)
+	{
+		int label = context.classify(&images[(size_t)i * size]);
+
+		totalCost -= std::log(std::max((double)context.getOutputs()[labels[i]], 1e-7));
+		numCorrect += (label == labels[i]) ? 1 : 0;
+	}
+
+	cost = (float)(totalCost / count);
+	accuracy = (float)numCorrect / count;
+}
+
+/**
+ * Runs CPUNeuralNet::train without its per-epoch log, so benchmarks can print their own tables
+*/
+inline void trainQuietly(CPUNeuralNet& network, unsigned int numIterations, unsigned int miniBatchSize, float trainingRate)
+{
+	std::ostringstream log;
+	std::streambuf* previous = std::cout.rdbuf(log.rdbuf());
+
+	network.train(numIterations, miniBatchSize, trainingRate);
+
+	std::cout.rdbuf(previous);
+}
\ No newline at end of file
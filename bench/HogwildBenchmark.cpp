@@ -0,0 +1,101 @@
+#include "BenchUtils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <string>
+
+/**
+ * Compares serial training with Hogwild, with and without the staleness bound. Every run
+ * starts from the same seed on the same data, and after every epoch reports the training
+ * cost, the accuracy on a held-out test set and the wall-clock time of that epoch.
+ * The serial run repeats exactly. The Hogwild runs depend on how the workers interleave,
+ * so repeat them to see the spread. With one core they only show the scheduling overhead.
+ *
+ * Usage: hogwildBenchmark [numThreads] [numEpochs] [numImages] [maxStaleness]
+*/
+
+static const uint32_t NETWORK_SEED = 7;
+static const unsigned int MINI_BATCH_SIZE = 32;
+static const float LEARNING_RATE = 0.05f;
+
+//Fraction of template pixels, low enough that accuracy keeps improving over several epochs
+static const float SIGNAL = 0.1f;
+
+//Images the training cost is measured on, the whole training set would dominate the run time
+static const int NUM_COST_IMAGES = 2000;
+
+struct Run
+{
+	std::string name;
+	unsigned int numThreads;
+	unsigned int maxStaleness;
+};
+
+static void benchmarkRun(const Run& run, const std::vector<byte>& images, const std::vector<byte>& labels,
+	const std::vector<byte>& testImages, const std::vector<byte>& testLabels, unsigned int numEpochs)
+{
+	const int numImages = (int)labels.size();
+	const int numTest = (int)testLabels.size();
+
+	CPUNeuralNet network({ LayerDesc(IMAGE_SIZE * IMAGE_SIZE), LayerDesc(256, FUNC_RELU), LayerDesc(10, FUNC_SOFTMAX) }, NETWORK_SEED);
+	network.loadImageData((byte*)images.data(), IMAGE_SIZE, IMAGE_SIZE, numImages);
+	network.loadLabelData((byte*)labels.data(), numImages);
+
+	AsyncConfig config;
+	config.numThreads = run.numThreads;
+	config.maxStaleness = run.maxStaleness;
+	network.setAsyncConfig(config);
+
+	printf("%s\n", run.name.c_str());
+	printf("%6s %12s %14s %12s\n", "epoch", "train cost", "test accuracy", "seconds");
+
+	double totalSeconds = 0.0;
+
+	for(unsigned int epoch = 0; epoch < numEpochs; ++epoch)
+	{
+		auto start = std::chrono::steady_clock::now();
+		trainQuietly(network, 1, MINI_BATCH_SIZE, LEARNING_RATE);
+		double seconds = secondsSince(start);
+		totalSeconds += seconds;
+
+		std::shared_ptr<const InferenceModel> model = network.exportModel();
+
+		float cost, accuracy, testCost;
+		evaluate(model, images, labels, std::min(numImages, NUM_COST_IMAGES), cost, accuracy);
+		evaluate(model, testImages, testLabels, numTest, testCost, accuracy);
+
+		printf("%6u %12.4f %13.2f%% %12.3f\n", epoch, cost, accuracy * 100, seconds);
+	}
+
+	printf("%6s %12s %14s %12.3f\n\n", "total", "", "", totalSeconds);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int numThreads = (argc > 1) ? (unsigned int)atoi(argv[1]) : std::max(2u, std::thread::hardware_concurrency());
+	unsigned int numEpochs = (argc > 2) ? (unsigned int)atoi(argv[2]) : 5;
+	int numImages = (argc > 3) ? atoi(argv[3]) : 20000;
+	unsigned int maxStaleness = (argc > 4) ? (unsigned int)atoi(argv[4]) : numThreads;
+
+	std::vector<byte> images, labels;
+	std::vector<byte> testImages, testLabels;
+	makeImages(images, labels, numImages, 1, SIGNAL);
+	makeImages(testImages, testLabels, std::max(1, numImages / 5), 2, SIGNAL);
+
+	printf("%d training images, %zu test images, %u epochs, seed %u\n\n", numImages, testLabels.size(), numEpochs, NETWORK_SEED);
+
+	std::vector<Run> runs = {
+		{ "Serial", 1, 0 },
+		{ "Hogwild " + std::to_string(numThreads) + " threads, unbounded", numThreads, 0 },
+		{ "Hogwild " + std::to_string(numThreads) + " threads, staleness <= " + std::to_string(maxStaleness), numThreads, maxStaleness }
+	};
+
+	for(const Run& run : runs)
+	{
+		benchmarkRun(run, images, labels, testImages, testLabels, numEpochs);
+	}
+
+	return 0;
+}
\ No newline at end of file
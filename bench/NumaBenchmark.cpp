@@ -0,0 +1,172 @@
+#include "BenchUtils.h"
+#include "Topology.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/**
+ * Measures what NUMA placement saves on a multi-socket host:
+ *  1. read bandwidth of a buffer first touched on each node, read from every node
+ *  2. Hogwild training with and without pinned workers
+ *  3. inference from every node against one shared model and against ReplicatedModel
+ * The timings show the cost of cross-socket traffic. To count the traffic itself, run the
+ * benchmark under perf stat with the platform's socket interconnect (UPI / xGMI) counters.
+ *
+ * Usage: numaBenchmark [numImages] [bufferMegabytes]
+*/
+
+static void benchmarkBandwidth(size_t bufferBytes)
+{
+	const Topology& topology = Topology::get();
+	const size_t numNodes = topology.getNumNodes();
+	const size_t count = bufferBytes / sizeof(uint64_t);
+
+	printf("Read bandwidth (GB/s), rows: memory node, columns: reading node\n");
+
+	for(size_t memoryNode = 0; memoryNode < numNodes; ++memoryNode)
+	{
+		std::unique_ptr<uint64_t[]> buffer;
+
+		//First touch from a thread pinned to memoryNode places the pages there
+		std::thread([&]() {
+			topology.pinCurrentThread(memoryNode);
+			buffer.reset(new uint64_t[count]);
+			for(size_t i = 0; i < count; ++i)
+			{
+				buffer[i] = i;
+			}
+		}).join();
+
+		printf("node %3d", topology.getNode(memoryNode).id);
+
+		for(size_t readNode = 0; readNode < numNodes; ++readNode)
+		{
+			double seconds = 0.0;
+			uint64_t sum = 0;
+
+			std::thread([&]() {
+				topology.pinCurrentThread(readNode);
+
+				auto start = std::chrono::steady_clock::now();
+				for(int pass = 0; pass < 4; ++pass)
+				{
+					for(size_t i = 0; i < count; ++i)
+					{
+						sum += buffer[i];
+					}
+				}
+				seconds = secondsSince(start);
+			}).join();
+
+			printf(" %8.2f", 4.0 * bufferBytes / seconds / 1e9);
+
+			//Keeps the reads from being optimized away
+			if(sum == 1)
+			{
+				printf("!");
+			}
+		}
+
+		printf("\n");
+	}
+}
+
+static void benchmarkTraining(const std::vector<byte>& images, const std::vector<byte>& labels, unsigned int numThreads)
+{
+	const int numImages = (int)labels.size();
+
+	for(int pinned = 0; pinned < 2; ++pinned)
+	{
+		CPUNeuralNet network({ LayerDesc(IMAGE_SIZE * IMAGE_SIZE), LayerDesc(256), LayerDesc(10, FUNC_SOFTMAX) }, 1);
+		network.loadImageData((byte*)images.data(), IMAGE_SIZE, IMAGE_SIZE, numImages);
+		network.loadLabelData((byte*)labels.data(), numImages);
+
+		AsyncConfig config;
+		config.numThreads = numThreads;
+		config.pinThreads = pinned == 1;
+		network.setAsyncConfig(config);
+
+		auto start = std::chrono::steady_clock::now();
+		network.train(2, 32, 0.05f);
+		double seconds = secondsSince(start);
+
+		printf("Hogwild %u threads, %-8s %8.3f s per epoch\n", numThreads, pinned ? "pinned" : "unpinned", seconds / 2);
+	}
+}
+
+static void benchmarkInference(const std::vector<byte>& images, const std::vector<byte>& labels)
+{
+	const Topology& topology = Topology::get();
+	const int numImages = (int)labels.size();
+	const int size = IMAGE_SIZE * IMAGE_SIZE;
+
+	CPUNeuralNet network({ LayerDesc(size), LayerDesc(512), LayerDesc(256), LayerDesc(10, FUNC_SOFTMAX) }, 1);
+
+	//Replica 0 is placed on node 0 like a model shared by every node would be
+	ReplicatedModel replicated(network.exportModel());
+
+	for(int local = 0; local < 2; ++local)
+	{
+		std::vector<std::thread> threads;
+		auto start = std::chrono::steady_clock::now();
+
+		//One serving thread per core, pinned to that core's node
+		for(size_t node = 0; node < topology.getNumNodes(); ++node)
+		{
+			for(size_t core = 0; core < topology.getNode(node).cpus.size(); ++core)
+			{
+				threads.push_back(std::thread([&, node]() {
+					topology.pinCurrentThread(node);
+
+					InferenceContext context(local ? replicated.getLocal() : replicated.getReplica(0));
+					for(int i = 0; i < numImages; ++i)
+					{
+						context.classify(&images[(size_t)i * size]);
+					}
+				}));
+			}
+		}
+
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		double seconds = secondsSince(start);
+		printf("Inference, %-16s %10.0f images/s\n", local ? "local replicas" : "shared model", threads.size() * numImages / seconds);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int numImages = (argc > 1) ? atoi(argv[1]) : 20000;
+	size_t bufferMegabytes = (argc > 2) ? (size_t)atoi(argv[2]) : 256;
+
+	const Topology& topology = Topology::get();
+
+	unsigned int numCores = 0;
+	for(size_t node = 0; node < topology.getNumNodes(); ++node)
+	{
+		numCores += (unsigned int)topology.getNode(node).cpus.size();
+	}
+
+	printf("%zu NUMA nodes, %u cores\n\n", topology.getNumNodes(), numCores);
+
+	benchmarkBandwidth(bufferMegabytes << 20);
+	printf("\n");
+
+	std::vector<byte> images;
+	std::vector<byte> labels;
+	makeImages(images, labels, numImages);
+
+	benchmarkTraining(images, labels, numCores);
+	printf("\n");
+
+	benchmarkInference(images, labels);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "BenchUtils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+/**
+ * Sweeps pruning levels for magnitude and 4x8 block pruning. Each type starts from the same
+ * trained network and prunes it further step by step, fine-tuning after every step. Every
+ * row reports the test accuracy, the sparsity of each dense layer, the exported model size
+ * and how many layers switched to BlockSparseMatrix, and single and batched inference speed.
+ *
+ * Usage: pruneBenchmark [numImages] [trainingEpochs] [fineTuneEpochs]
+*/
+
+static const uint32_t NETWORK_SEED = 3;
+static const unsigned int MINI_BATCH_SIZE = 32;
+static const float LEARNING_RATE = 0.05f;
+static const float FINE_TUNE_RATE = 0.02f;
+static const float SIGNAL = 0.1f;
+static const int INFERENCE_BATCH = 64;
+
+static const float SPARSITIES[] = { 0.5f, 0.8f, 0.9f, 0.95f };
+
+static void report(const std::string& name, const CPUNeuralNet& network, const std::vector<byte>& images, const std::vector<byte>& labels)
+{
+	const int numImages = (int)labels.size();
+	const int size = IMAGE_SIZE * IMAGE_SIZE;
+
+	std::shared_ptr<const InferenceModel> model = network.exportModel();
+
+	float cost, accuracy;
+	evaluate(model, images, labels, numImages, cost, accuracy);
+
+	InferenceContext context(model);
+
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < numImages; ++i)
+	{
+		context.classify(&images[(size_t)i * size]);
+	}
+	double singleSeconds = secondsSince(start);
+
+	std::vector<int> batchLabels(INFERENCE_BATCH);
+	int numBatched = numImages / INFERENCE_BATCH * INFERENCE_BATCH;
+
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < numBatched; i += INFERENCE_BATCH)
+	{
+		context.classifyBatch(&images[(size_t)i * size], INFERENCE_BATCH, batchLabels.data());
+	}
+	double batchSeconds = secondsSince(start);
+
+	std::string sparsities;
+	const std::vector<NetworkLayer>& layers = network.getLayers();
+	for(size_t j = 1; j < layers.size(); ++j)
+	{
+		char layerSparsity[16];
+		snprintf(layerSparsity, sizeof(layerSparsity), "%s%.0f%%", j > 1 ? "/" : "", layers[j].getSparsity() * 100);
+		sparsities += layerSparsity;
+	}
+
+	printf("%-20s %8.2f%% %14s %10.1f %7d %12.0f %12.0f\n", name.c_str(), accuracy * 100, sparsities.c_str(),
+		model->getWeightBytes() / 1024.0, model->getNumSparseLayers(), numImages / singleSeconds, numBatched / batchSeconds);
+}
+
+int main(int argc, char** argv)
+{
+	int numImages = (argc > 1) ? atoi(argv[1]) : 12000;
+	unsigned int trainingEpochs = (argc > 2) ? (unsigned int)atoi(argv[2]) : 3;
+	unsigned int fineTuneEpochs = (argc > 3) ? (unsigned int)atoi(argv[3]) : 1;
+
+	std::vector<byte> images, labels;
+	std::vector<byte> testImages, testLabels;
+	makeImages(images, labels, numImages, 1, SIGNAL);
+	makeImages(testImages, testLabels, std::max(1, numImages / 4), 2, SIGNAL);
+
+	printf("%d training images, %zu test images, %u epochs, %u fine-tuning epochs per step\n\n",
+		numImages, testLabels.size(), trainingEpochs, fineTuneEpochs);
+	printf("%-20s %9s %14s %10s %7s %12s %12s\n", "", "accuracy", "sparsity", "weight KB", "sparse", "images/s", "batched/s");
+
+	for(int type = 0; type < 2; ++type)
+	{
+		PruningType pruning = type ? PRUNE_BLOCK : PRUNE_MAGNITUDE;
+		std::string typeName = type ? "block" : "magnitude";
+
+		//Serial training from the same seed, so both types start from the same network
+		CPUNeuralNet network({ LayerDesc(IMAGE_SIZE * IMAGE_SIZE), LayerDesc(512), LayerDesc(256), LayerDesc(10, FUNC_SOFTMAX) }, NETWORK_SEED);
+		network.loadImageData(images.data(), IMAGE_SIZE, IMAGE_SIZE, numImages);
+		network.loadLabelData(labels.data(), numImages);
+		trainQuietly(network, trainingEpochs, MINI_BATCH_SIZE, LEARNING_RATE);
+
+		if(type == 0)
+		{
+			report("dense", network, testImages, testLabels);
+		}
+
+		for(float sparsity : SPARSITIES)
+		{
+			std::string name = typeName + " " + std::to_string((int)(sparsity * 100)) + "%";
+
+			network.prune(sparsity, pruning);
+			report(name, network, testImages, testLabels);
+
+			trainQuietly(network, fineTuneEpochs, MINI_BATCH_SIZE, FINE_TUNE_RATE);
+			report(name + " tuned", network, testImages, testLabels);
+		}
+	}
+
+	return 0;
+}
\ No newline at end of file
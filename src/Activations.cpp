@@ -0,0 +1,180 @@
+#include "Activations.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+static const float LEAKY_RELU_SLOPE = 0.01f;
+static const float GELU_SCALE = 0.7978845608f; //sqrt(2 / pi)
+static const float GELU_CUBIC = 0.044715f;
+
+float sigmoid(float value)
+{
+	return (float)(1.0 / (1.0 + exp(-value)));
+}
+
+float relu(float value)
+{
+	return std::max(0.0f, value);
+}
+
+//Written in terms of sigmoid, e / (1 + e)^2 overflows for large negative values
+static float sigmoid_der(float value)
+{
+	float s = sigmoid(value);
+	return s * (1.0f - s);
+}
+
+static float relu_der(float value)
+{
+	if(value >= 0)
+	{
+		return 1.0f;
+	}
+	else
+	{
+		return 0.0f;
+	}
+}
+
+static float leaky_relu(float value)
+{
+	return value >= 0 ? value : LEAKY_RELU_SLOPE * value;
+}
+
+static float leaky_relu_der(float value)
+{
+	return value >= 0 ? 1.0f : LEAKY_RELU_SLOPE;
+}
+
+static float tanh_der(float value)
+{
+	float t = tanhf(value);
+	return 1.0f - t * t;
+}
+
+//Tanh approximation
+static float gelu(float value)
+{
+	float inner = GELU_SCALE * (value + GELU_CUBIC * value * value * value);
+	return 0.5f * value * (1.0f + tanhf(inner));
+}
+
+static float gelu_der(float value)
+{
+	float inner = GELU_SCALE * (value + GELU_CUBIC * value * value * value);
+	float t = tanhf(inner);
+	float innerDerivative = GELU_SCALE * (1.0f + 3.0f * GELU_CUBIC * value * value);
+
+	return 0.5f * (1.0f + t) + 0.5f * value * (1.0f - t * t) * innerDerivative;
+}
+
+template<float(*Function)(float)>
+static void applyElementwise(const float* input, float* output, unsigned int count)
+{
+	for(unsigned int i = 0; i < count; ++i)
+	{
+		output[i] = Function(input[i]);
+	}
+}
+
+template<float(*Derivative)(float)>
+static void chainElementwise(const float* weightedSums, const float* activationDerivatives, float* output, unsigned int count)
+{
+	for(unsigned int i = 0; i < count; ++i)
+	{
+		output[i] = Derivative(weightedSums[i]) * activationDerivatives[i];
+	}
+}
+
+static void softmax(const float* weightedSums, float* activations, unsigned int rows, unsigned int columns)
+{
+	for(unsigned int j = 0; j < columns; ++j)
+	{
+		float maxValue = weightedSums[j];
+		for(unsigned int i = 1; i < rows; ++i)
+		{
+			maxValue = std::max(maxValue, weightedSums[i * columns + j]);
+		}
+
+		float sum = 0.0f;
+		for(unsigned int i = 0; i < rows; ++i)
+		{
+			float value = expf(weightedSums[i * columns + j] - maxValue);
+			activations[i * columns + j] = value;
+			sum += value;
+		}
+
+		for(unsigned int i = 0; i < rows; ++i)
+		{
+			activations[i * columns + j] /= sum;
+		}
+	}
+}
+
+float weightInitRange(WeightInit scheme, FunctionType functionType, int fanIn, int fanOut)
+{
+	if(scheme == INIT_AUTO)
+	{
+		bool rectified = (functionType == FUNC_RELU || functionType == FUNC_LEAKY_RELU || functionType == FUNC_GELU);
+		scheme = rectified ? INIT_HE : INIT_XAVIER;
+	}
+
+	if(scheme == INIT_HE)
+	{
+		return sqrtf(6.0f / std::max(1, fanIn));
+	}
+
+	return sqrtf(6.0f / std::max(1, fanIn + fanOut));
+}
+
+void applyActivation(FunctionType functionType, const float* weightedSums, float* activations, unsigned int rows, unsigned int columns)
+{
+	unsigned int count = rows * columns;
+
+	switch(functionType)
+	{
+	case FUNC_SIGMOID:		applyElementwise<sigmoid>(weightedSums, activations, count); break;
+	case FUNC_LEAKY_RELU:	applyElementwise<leaky_relu>(weightedSums, activations, count); break;
+	case FUNC_TANH:			applyElementwise<tanhf>(weightedSums, activations, count); break;
+	case FUNC_GELU:			applyElementwise<gelu>(weightedSums, activations, count); break;
+	case FUNC_SOFTMAX:		softmax(weightedSums, activations, rows, columns); break;
+	default:				applyElementwise<relu>(weightedSums, activations, count); break;
+	}
+}
+
+void activationGradient(FunctionType functionType, const float* weightedSums, const float* activationDerivatives, float* weightedSumDerivatives, unsigned int rows, unsigned int columns)
+{
+	unsigned int count = rows * columns;
+
+	switch(functionType)
+	{
+	case FUNC_SIGMOID:		chainElementwise<sigmoid_der>(weightedSums, activationDerivatives, weightedSumDerivatives, count); break;
+	case FUNC_LEAKY_RELU:	chainElementwise<leaky_relu_der>(weightedSums, activationDerivatives, weightedSumDerivatives, count); break;
+	case FUNC_TANH:			chainElementwise<tanh_der>(weightedSums, activationDerivatives, weightedSumDerivatives, count); break;
+	case FUNC_GELU:			chainElementwise<gelu_der>(weightedSums, activationDerivatives, weightedSumDerivatives, count); break;
+	case FUNC_SOFTMAX:
+	{
+		//dZ = A * (dA - sum(A * dA)) per column
+		std::vector<float> activations(count);
+		softmax(weightedSums, activations.data(), rows, columns);
+
+		for(unsigned int j = 0; j < columns; ++j)
+		{
+			float weightedDerivative = 0.0f;
+			for(unsigned int i = 0; i < rows; ++i)
+			{
+				weightedDerivative += activations[i * columns + j] * activationDerivatives[i * columns + j];
+			}
+
+			for(unsigned int i = 0; i < rows; ++i)
+			{
+				unsigned int index = i * columns + j;
+				weightedSumDerivatives[index] = activations[index] * (activationDerivatives[index] - weightedDerivative);
+			}
+		}
+		break;
+	}
+	default:				chainElementwise<relu_der>(weightedSums, activationDerivatives, weightedSumDerivatives, count); break;
+	}
+}
\ No newline at end of file
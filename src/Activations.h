@@ -0,0 +1,38 @@
+#pragma once
+
+enum FunctionType
+{
+	FUNC_RELU,
+	FUNC_SIGMOID,
+	FUNC_LEAKY_RELU,
+	FUNC_TANH,
+	FUNC_GELU,
+	FUNC_SOFTMAX
+};
+
+enum WeightInit
+{
+	INIT_AUTO,		//He for the ReLU family and GELU, Xavier otherwise
+	INIT_XAVIER,	//Uniform, limit sqrt(6 / (fanIn + fanOut))
+	INIT_HE			//Uniform, limit sqrt(6 / fanIn)
+};
+
+/**
+ * Half width of the uniform weight range for the given scheme
+*/
+float weightInitRange(WeightInit scheme, FunctionType functionType, int fanIn, int fanOut);
+
+float sigmoid(float value);
+float relu(float value);
+
+/**
+ * Values are stored row-major with one example per column, like the Matrix class.
+ * The function type is resolved once per call rather than per element, and softmax
+ * normalizes each column. weightedSums and activations may alias.
+*/
+void applyActivation(FunctionType functionType, const float* weightedSums, float* activations, unsigned int rows, unsigned int columns);
+
+/**
+ * Computes dL/dZ from dL/dA for the values Z that produced the activations
+*/
+void activationGradient(FunctionType functionType, const float* weightedSums, const float* activationDerivatives, float* weightedSumDerivatives, unsigned int rows, unsigned int columns);
\ No newline at end of file
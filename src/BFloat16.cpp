@@ -0,0 +1,91 @@
+#include "BFloat16.h"
+
+//The AVX512 paths are compiled with per-function target attributes and picked at run time,
+//so the default build needs no -mavx512 flags and still runs on any x86-64 CPU
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BF16_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+#ifdef BF16_X86_DISPATCH
+/**
+ * Converts the multiples of 16 values and returns how many were converted. Denormal inputs
+ * are flushed to zero by the instruction, every other value matches floatToBF16.
+*/
+__attribute__((target("avx512f,avx512bf16")))
+static size_t convertToBF16AVX512(const float* input, bfloat16* output, size_t count)
+{
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16)
+	{
+		__m256bh converted = _mm512_cvtneps_pbh(_mm512_loadu_ps(input + i));
+		_mm256_storeu_si256((__m256i*)(output + i), (__m256i)converted);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx512f")))
+static size_t convertToFloatAVX512(const bfloat16* input, float* output, size_t count)
+{
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16)
+	{
+		__m512i widened = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(input + i)));
+		_mm512_storeu_ps(output + i, _mm512_castsi512_ps(_mm512_slli_epi32(widened, 16)));
+	}
+
+	return i;
+}
+
+static bool cpuSupports(bool avx512bf16)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f") && (!avx512bf16 || __builtin_cpu_supports("avx512bf16"));
+}
+#endif
+
+bool hasNativeBF16Conversion()
+{
+#ifdef BF16_X86_DISPATCH
+	static const bool supported = cpuSupports(true);
+	return supported;
+#else
+	return false;
+#endif
+}
+
+void convertToBF16(const float* input, bfloat16* output, size_t count)
+{
+	size_t i = 0;
+
+#ifdef BF16_X86_DISPATCH
+	if(hasNativeBF16Conversion())
+	{
+		i = convertToBF16AVX512(input, output, count);
+	}
+#endif
+
+	for(; i < count; ++i)
+	{
+		output[i] = floatToBF16(input[i]);
+	}
+}
+
+void convertToFloat(const bfloat16* input, float* output, size_t count)
+{
+	size_t i = 0;
+
+#ifdef BF16_X86_DISPATCH
+	static const bool avx512 = cpuSupports(false);
+	if(avx512)
+	{
+		i = convertToFloatAVX512(input, output, count);
+	}
+#endif
+
+	for(; i < count; ++i)
+	{
+		output[i] = bf16ToFloat(input[i]);
+	}
+}
\ No newline at end of file
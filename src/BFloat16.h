@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Matrix.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+typedef uint16_t bfloat16;
+
+/**
+ * Round to nearest even, keeps NaNs quiet
+*/
+inline bfloat16 floatToBF16(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	if((bits & 0x7FFFFFFFu) > 0x7F800000u)
+	{
+		return (bfloat16)((bits >> 16) | 0x0040u);
+	}
+
+	bits += 0x7FFFu + ((bits >> 16) & 1u);
+	return (bfloat16)(bits >> 16);
+}
+
+inline float bf16ToFloat(bfloat16 value)
+{
+	uint32_t bits = (uint32_t)value << 16;
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+
+	return result;
+}
+
+/**
+ * Use the AVX512-BF16 and AVX512F conversions when the CPU has them, the scalar versions
+ * above otherwise. The AVX512-BF16 path flushes denormal inputs to zero.
+*/
+void convertToBF16(const float* input, bfloat16* output, size_t count);
+void convertToFloat(const bfloat16* input, float* output, size_t count);
+
+/**
+ * Whether convertToBF16 runs the AVX512-BF16 path on this CPU
+*/
+bool hasNativeBF16Conversion();
+
+/**
+ * Half size storage for matrices that are only read back later, like activations kept for backpropagation.
+ * All arithmetic happens on the fp32 Matrix returned by toMatrix.
+*/
+class BF16Matrix
+{
+private:
+	unsigned int m_rows = 0;
+	unsigned int m_columns = 0;
+
+	std::vector<bfloat16> m_data;
+public:
+	BF16Matrix() {}
+
+	explicit BF16Matrix(const Matrix& matrix) :
+		m_rows(matrix.getRows()), m_columns(matrix.getColumns()), m_data((size_t)matrix.getRows() * matrix.getColumns())
+	{
+		convertToBF16(matrix.getData(), m_data.data(), m_data.size());
+	}
+
+	inline Matrix toMatrix() const
+	{
+		Matrix mat(m_rows, m_columns);
+		convertToFloat(m_data.data(), mat.getData(), m_data.size());
+
+		return mat;
+	}
+
+	inline unsigned int getRows() const { return m_rows; }
+	inline unsigned int getColumns() const { return m_columns; }
+};
\ No newline at end of file
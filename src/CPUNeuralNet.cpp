@@ -1,126 +1,402 @@
 #include "CPUNeuralNet.h"
+#include "InferenceModel.h"
+#include "Topology.h"
+#include "SparseMatrix.h"
 
 #include <math.h>
 #include <cstring>
 #include <cstdio>
-#include <random>
-#include <ctime>
 #include <iostream>
+#include <future>
+#include <limits>
+#include <atomic>
+#include <thread>
 
-float sigmoid(float value)
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TRANSPOSE_SSE
+#endif
+
+const float NetworkLayer::BATCH_NORM_EPSILON = 1e-5f;
+const float NetworkLayer::BATCH_NORM_MOMENTUM = 0.9f;
+
+/**
+ * Each column is an example's activations
+*/
+Matrix NetworkLayer::calculateAcitvations(const Matrix& previousActivations, LayerCache* cache) const
+{
+	Matrix weightedSum = m_weights.dot(previousActivations) + m_biases;
+
+	unsigned int rows = weightedSum.getRows();
+	unsigned int columns = weightedSum.getColumns();
+
+	if(m_batchNorm)
+	{
+		Matrix mean = m_runningMean;
+		Matrix variance = m_runningVariance;
+
+		if(cache)
+		{
+			mean = (1.0f / columns) * weightedSum.sumAcross(AXIS_HORIZONTAL);
+
+			Matrix centered = weightedSum - mean;
+			variance = (1.0f / columns) * (centered * centered).sumAcross(AXIS_HORIZONTAL);
+
+			cache->batchMean = mean;
+			cache->batchVariance = variance;
+			cache->normalizedSums = Matrix(rows, columns);
+		}
+
+		float* sums = weightedSum.getData();
+		for(unsigned int i = 0; i < rows; ++i)
+		{
+			float inverseStdDev = 1.0f / sqrtf(variance.getValue(i, 0) + BATCH_NORM_EPSILON);
+			float gamma = m_gamma.getValue(i, 0);
+			float beta = m_beta.getValue(i, 0);
+
+			for(unsigned int j = 0; j < columns; ++j)
+			{
+				float normalized = (sums[i * columns + j] - mean.getValue(i, 0)) * inverseStdDev;
+
+				if(cache)
+				{
+					cache->normalizedSums.setValue(i, j, normalized);
+				}
+
+				sums[i * columns + j] = gamma * normalized + beta;
+			}
+		}
+	}
+
+	Matrix activations(rows, columns);
+	applyActivation(m_functionType, weightedSum.getData(), activations.getData(), rows, columns);
+
+	if(cache)
+	{
+		cache->weightedSums = weightedSum;
+
+		if(m_dropoutRate > 0.0f)
+		{
+			//Inverted dropout, so inference needs no rescaling
+			float keepProbability = 1.0f - m_dropoutRate;
+
+			Philox generator(m_seed);
+			uint64_t stream = FIRST_DROPOUT_STREAM + cache->dropoutStep;
+
+			cache->dropoutMask = Matrix(rows, columns);
+			fillUniform(cache->dropoutMask.getData(), rows * columns, 0.0f, 1.0f, generator, stream, false);
+			cache->dropoutMask.apply([=](float value) -> float {
+				return (value < keepProbability) ? 1.0f / keepProbability : 0.0f;
+			});
+
+			activations = activations * cache->dropoutMask;
+		}
+	}
+
+	return activations;
+}
+
+void NetworkLayer::initWeightsAndBiases(float weightRangeStart, float weightRangeEnd, float biasRangeStart, float biasRangeEnd, uint64_t seed)
 {
-	return (float)(1.0 / (1.0 + exp(-value)));
+	m_seed = seed;
+	Philox generator(seed);
+
+	fillUniform(m_weights.getData(), m_weights.getRows() * m_weights.getColumns(), weightRangeStart, weightRangeEnd, generator, WEIGHT_STREAM);
+
+#if 0
+	fillUniform(m_biases.getData(), m_biases.getRows(), biasRangeStart, biasRangeEnd, generator, BIAS_STREAM);
+#else
+	m_biases.initValue(0);
+#endif
 }
 
-float relu(float value)
+void NetworkLayer::initWeights(WeightInit scheme, uint64_t seed)
 {
-	return std::max(0.0f, value);
+	float range = weightInitRange(scheme, m_functionType, m_previousLayerSize, m_layerSize);
+	initWeightsAndBiases(-range, range, -1, 1, seed);
 }
 
-float sigmoid_der(float value)
+//activationDerviatives -> (m_layerSize, numExamples)
+Matrix NetworkLayer::gradientDescent(const Matrix& activationDerivatives, const LayerCache& cache, const Matrix& previousLayerActivations, float learningRate,
+	bool weightedSumDerivatives)
 {
-	float e = expf(-value);
-	return e / ((1 + e) * (1 + e));
+	LayerGradients gradients;
+	Matrix dPrevious = computeGradients(activationDerivatives, cache, previousLayerActivations, gradients, weightedSumDerivatives);
+
+	applyGradients(gradients, learningRate);
+
+	return dPrevious;
 }
 
-float relu_der(float value)
+Matrix NetworkLayer::computeGradients(const Matrix& activationDerivatives, const LayerCache& cache, const Matrix& previousLayerActivations, LayerGradients& gradients,
+	bool weightedSumDerivatives) const
 {
-	if(value >= 0)
+	Matrix dA = activationDerivatives;
+
+	if(m_dropoutRate > 0.0f)
 	{
-		return 1.0f;
+		dA = dA * cache.dropoutMask;
 	}
-	else
+
+	unsigned int rows = dA.getRows();
+	unsigned int columns = dA.getColumns();
+
+	Matrix dZ = dA;
+	if(!weightedSumDerivatives)
+	{
+		dZ = Matrix(rows, columns);
+		activationGradient(m_functionType, cache.weightedSums.getData(), dA.getData(), dZ.getData(), rows, columns);
+	}
+
+	int m = dZ.getColumns();
+	float inverseM = (m > 0) ? 1.0f / m : 0.0f; //An empty batch has zero gradients
+
+	if(m_batchNorm)
+	{
+		Matrix dY = dZ;
+		Matrix xHat = cache.normalizedSums;
+
+		Matrix dGamma = Matrix::sumAcross(dY * xHat, AXIS_HORIZONTAL);
+		Matrix dBeta = dY.sumAcross(AXIS_HORIZONTAL);
+
+		//Gradient through the batch statistics
+		Matrix dXHat = dY * m_gamma;
+		Matrix dXHatSum = dXHat.sumAcross(AXIS_HORIZONTAL);
+		Matrix dXHatXHatSum = Matrix::sumAcross(dXHat * xHat, AXIS_HORIZONTAL);
+
+		dZ = Matrix(rows, columns);
+		for(unsigned int i = 0; i < rows; ++i)
+		{
+			float inverseStdDev = 1.0f / sqrtf(cache.batchVariance.getValue(i, 0) + BATCH_NORM_EPSILON);
+
+			for(unsigned int j = 0; j < columns; ++j)
+			{
+				float value = m * dXHat.getValue(i, j) - dXHatSum.getValue(i, 0) - xHat.getValue(i, j) * dXHatXHatSum.getValue(i, 0);
+				dZ.setValue(i, j, inverseStdDev / m * value);
+			}
+		}
+
+		gradients.gamma = inverseM * dGamma;
+		gradients.beta = inverseM * dBeta;
+		gradients.batchMean = cache.batchMean;
+		gradients.batchVariance = cache.batchVariance;
+	}
+
+	gradients.biases = inverseM * dZ.sumAcross(AXIS_HORIZONTAL);
+	gradients.weights = inverseM * dZ.dot(previousLayerActivations.transpose());
+
+	return m_weights.transpose().dot(dZ);
+}
+
+void NetworkLayer::applyGradients(const LayerGradients& gradients, float learningRate)
+{
+	if(m_batchNorm)
+	{
+		m_gamma.addScaled(gradients.gamma, -learningRate);
+		m_beta.addScaled(gradients.beta, -learningRate);
+
+		auto decay = [](float value) -> float { return BATCH_NORM_MOMENTUM * value; };
+		m_runningMean.apply(decay).addScaled(gradients.batchMean, 1.0f - BATCH_NORM_MOMENTUM);
+		m_runningVariance.apply(decay).addScaled(gradients.batchVariance, 1.0f - BATCH_NORM_MOMENTUM);
+	}
+
+	m_weights.addScaled(gradients.weights, -learningRate);
+	m_biases.addScaled(gradients.biases, -learningRate);
+
+	if(m_pruned)
 	{
-		return 0.001f * value;
+		applyPruningMask();
 	}
 }
 
-/**
- * Each column is an example's activations
-*/
-Matrix NetworkLayer::calculateAcitvations(const Matrix& previousActivations, Matrix* weightedSumStore) const
+void NetworkLayer::applyPruningMask()
 {
-	Matrix weightedSum = m_weights.dot(previousActivations) + m_biases;
-	
-	if(weightedSumStore)
+	float* weights = m_weights.getData();
+	const float* mask = m_pruningMask.getData();
+
+	for(unsigned int i = 0; i < m_weights.getRows() * m_weights.getColumns(); ++i)
+	{
+		weights[i] *= mask[i];
+	}
+}
+
+void NetworkLayer::prune(float sparsity, PruningType type)
+{
+	const int rows = m_weights.getRows();
+	const int columns = m_weights.getColumns();
+	const float* weights = m_weights.getData();
+
+	if(!m_pruned)
 	{
-		*weightedSumStore = weightedSum;
+		m_pruningMask = Matrix(rows, columns).initValue(1);
+		m_pruned = true;
 	}
 
-	if(m_functionType == FUNC_SIGMOID)
+	float* mask = m_pruningMask.getData();
+
+	if(type == PRUNE_MAGNITUDE)
 	{
-		return weightedSum.applyCopy(sigmoid);
+		std::vector<int> order(rows * columns);
+		for(int i = 0; i < rows * columns; ++i)
+		{
+			order[i] = i;
+		}
+
+		//Already pruned weights are zero, so they are counted first
+		size_t numPruned = std::min(order.size(), (size_t)(sparsity * order.size() + 0.5f));
+		std::nth_element(order.begin(), order.begin() + numPruned, order.end(), [&](int a, int b) {
+			return fabsf(weights[a]) < fabsf(weights[b]);
+		});
+
+		for(size_t i = 0; i < numPruned; ++i)
+		{
+			mask[order[i]] = 0.0f;
+		}
 	}
 	else
 	{
-		return weightedSum.applyCopy(relu);
+		const int blockRows = BlockSparseMatrix::BLOCK_ROWS;
+		const int blockColumns = BlockSparseMatrix::BLOCK_COLUMNS;
+
+		struct Block
+		{
+			int row;
+			int column;
+			float score; //Mean magnitude, partial blocks at the edges are not favoured
+		};
+
+		std::vector<Block> blocks;
+		for(int row = 0; row < rows; row += blockRows)
+		{
+			for(int column = 0; column < columns; column += blockColumns)
+			{
+				float sum = 0.0f;
+				int count = 0;
+
+				for(int i = row; i < std::min(rows, row + blockRows); ++i)
+				{
+					for(int j = column; j < std::min(columns, column + blockColumns); ++j)
+					{
+						sum += fabsf(weights[i * columns + j]);
+						++count;
+					}
+				}
+
+				Block block = { row, column, sum / count };
+				blocks.push_back(block);
+			}
+		}
+
+		size_t numPruned = std::min(blocks.size(), (size_t)(sparsity * blocks.size() + 0.5f));
+		std::nth_element(blocks.begin(), blocks.begin() + numPruned, blocks.end(), [](const Block& a, const Block& b) {
+			return a.score < b.score;
+		});
+
+		for(size_t b = 0; b < numPruned; ++b)
+		{
+			for(int i = blocks[b].row; i < std::min(rows, blocks[b].row + blockRows); ++i)
+			{
+				for(int j = blocks[b].column; j < std::min(columns, blocks[b].column + blockColumns); ++j)
+				{
+					mask[i * columns + j] = 0.0f;
+				}
+			}
+		}
 	}
+
+	applyPruningMask();
 }
 
-void NetworkLayer::initWeightsAndBiases(float weightRangeStart, float weightRangeEnd, float biasRangeStart, float biasRangeEnd)
+float NetworkLayer::getSparsity() const
 {
-	srand((unsigned int)time(0));
-
-	m_weights.apply([=](float) -> float {
-		float randomValue = static_cast<float>(rand()) / static_cast<float>(RAND_MAX + 1);
-		return randomValue * (weightRangeEnd - weightRangeStart) + weightRangeStart;
-	});
+	const float* weights = m_weights.getData();
+	unsigned int count = m_weights.getRows() * m_weights.getColumns();
 
-#if 0
-	m_biases.apply([=](float) -> float {
-		float randomValue = static_cast<float>(rand()) / static_cast<float>(RAND_MAX + 1);
-		return randomValue * (biasRangeEnd - biasRangeStart) + biasRangeStart;
-	});
-#else
-	m_biases.initValue(0);
-#endif
+	return (float)std::count(weights, weights + count, 0.0f) / count;
 }
 
-//activationDerviatives -> (m_layerSize, numExamples)
-Matrix NetworkLayer::gradientDescent(const Matrix& activationDerivatives, const Matrix& weightedSums, const Matrix& previousLayerActivations, float learningRate)
+void NetworkLayer::foldedWeightsAndBiases(Matrix& weights, Matrix& biases) const
 {
-	Matrix dZ(1, 1);
+	weights = m_weights.copy();
+	biases = m_biases.copy();
 
-	if(m_functionType == FUNC_SIGMOID)
+	if(!m_batchNorm)
 	{
-		dZ = weightedSums.applyCopy(sigmoid_der) * activationDerivatives;
+		return;
 	}
-	else
+
+	//gamma * (Wx + b - mean) / sqrt(var + eps) + beta == (scale * W)x + scale * (b - mean) + beta
+	for(unsigned int i = 0; i < weights.getRows(); ++i)
 	{
-		dZ = weightedSums.applyCopy(relu_der) * activationDerivatives;
+		float scale = m_gamma.getValue(i, 0) / sqrtf(m_runningVariance.getValue(i, 0) + BATCH_NORM_EPSILON);
+
+		for(unsigned int j = 0; j < weights.getColumns(); ++j)
+		{
+			weights.setValue(i, j, weights.getValue(i, j) * scale);
+		}
+
+		biases.setValue(i, 0, scale * (m_biases.getValue(i, 0) - m_runningMean.getValue(i, 0)) + m_beta.getValue(i, 0));
 	}
+}
 
-	int m = dZ.getColumns();
-	Matrix dB = 1.0f / m * dZ.sumAcross(AXIS_HORIZONTAL);
-	Matrix dW = 1.0f / m * dZ.dot(previousLayerActivations.transpose());
+CPUNeuralNet::CPUNeuralNet(const std::vector<LayerDesc>& layers, uint64_t seed)
+{
+	for(size_t i = 0; i < layers.size(); ++i)
+	{
+		m_layers.push_back(NetworkLayer(layers[i], (i == 0) ? 0 : layers[i - 1].layerSize));
+	}
+
+	initWeights(seed);
+}
+
+CPUNeuralNet::CPUNeuralNet(const ConvShape& inputShape, const std::vector<ConvLayerDesc>& convLayers, const std::vector<LayerDesc>& layers, uint64_t seed)
+{
+	ConvShape shape = inputShape;
+
+	for(const ConvLayerDesc& desc : convLayers)
+	{
+		m_convLayers.push_back(ConvLayer(desc, shape));
+		shape = m_convLayers.back().getOutputShape();
+	}
 
-	Matrix dA = m_weights.transpose().dot(dZ);
+	m_layers.push_back(NetworkLayer(shape.size(), 0, FUNC_RELU));
 
-	m_weights = m_weights - learningRate * dW;
-	m_biases = m_biases - learningRate * dB;
+	for(size_t i = 0; i < layers.size(); ++i)
+	{
+		m_layers.push_back(NetworkLayer(layers[i], m_layers.back().getLayerSize()));
+	}
 
-	return dA;
+	initWeights(seed);
 }
 
-CPUNeuralNet::CPUNeuralNet(int* layerSizes, int numLayers)// : m_layers(numLayers)
+CPUNeuralNet::CPUNeuralNet(int* layerSizes, int numLayers, uint64_t seed)
 {
 	for(int i = 0; i < numLayers; ++i) 
 	{
-		if(i == 0)
-		{
-			NetworkLayer layer(layerSizes[i], 0, FunctionType::FUNC_RELU);
-			layer.initWeightsAndBiases(-0.001f, 0.001f, -1, 1);
-			
-			m_layers.push_back(layer);
-		}
-		else
-		{
-			NetworkLayer layer(layerSizes[i], layerSizes[i - 1], (i < numLayers - 1) ? FunctionType::FUNC_RELU : FunctionType::FUNC_SIGMOID);
-			layer.initWeightsAndBiases(-0.001f, 0.001f, -1, 1);
-			
-			m_layers.push_back(layer);
-		}
+		LayerDesc desc(layerSizes[i], (i < numLayers - 1) ? FunctionType::FUNC_RELU : FunctionType::FUNC_SIGMOID);
+
+		m_layers.push_back(NetworkLayer(desc, (i == 0) ? 0 : layerSizes[i - 1]));
+	}
+
+	initWeights(seed);
+}
+
+void CPUNeuralNet::initWeights(uint64_t seed, WeightInit scheme)
+{
+	uint64_t layerIndex = 0;
+
+	for(ConvLayer& layer : m_convLayers)
+	{
+		layer.initWeights(scheme, deriveSeed(seed, layerIndex++));
+	}
+
+	//m_layers[0] only holds the input activations
+	for(size_t i = 1; i < m_layers.size(); ++i)
+	{
+		m_layers[i].initWeights(scheme, deriveSeed(seed, layerIndex++));
 	}
+
+	m_trainingStep = 0;
 }
 
 CPUNeuralNet::~CPUNeuralNet()
@@ -136,21 +412,75 @@ CPUNeuralNet::~CPUNeuralNet()
 	}
 }
 
+void CPUNeuralNet::prune(float sparsity, PruningType type)
+{
+	for(size_t i = 1; i < m_layers.size(); ++i)
+	{
+		m_layers[i].prune(sparsity, type);
+	}
+}
+
 void CPUNeuralNet::loadImageData(byte* imageData, int width, int height, int numImages)
 {
 	m_imageWidth = width;
 	m_imageHeight = height;
 	m_numImages = numImages;
 
-	int size = width * height;
-	m_imageData = new float[numImages * size];
+	if(m_imageData)
+	{
+		delete[] m_imageData;
+	}
+
+	m_loadedStorage = m_imageStorage;
+
+	size_t size = width * height;
+	m_imageStride = (unsigned int)((m_loadedStorage == STORAGE_BINARY) ? (size + 7) / 8 : size);
+
+	//Left untouched here so every shard's pages land on the node that writes them first
+	m_imageData = new byte[(size_t)numImages * m_imageStride];
+
+	const Topology& topology = Topology::get();
+	m_numShards = (unsigned int)std::min((size_t)std::max(1, numImages), topology.getNumNodes());
 
-	for(int i = 0; i < numImages; ++i)
+	if(m_numShards == 1)
 	{
-		for(int j = 0; j < size; ++j)
+		storeImages(imageData, 0, numImages);
+		return;
+	}
+
+	topology.runOnEachNode([&](size_t node) {
+		if(node < m_numShards)
+		{
+			unsigned int first = getShardBegin((unsigned int)node);
+			storeImages(imageData, first, getShardBegin((unsigned int)node + 1) - first);
+		}
+	});
+}
+
+void CPUNeuralNet::storeImages(const byte* imageData, unsigned int firstImage, unsigned int count)
+{
+	size_t size = m_imageWidth * m_imageHeight;
+	byte* stored = m_imageData + (size_t)firstImage * m_imageStride;
+	imageData += (size_t)firstImage * size;
+
+	if(m_loadedStorage == STORAGE_UINT8)
+	{
+		memcpy(stored, imageData, (size_t)count * size);
+		return;
+	}
+
+	memset(stored, 0, (size_t)count * m_imageStride);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		byte* bits = stored + i * m_imageStride;
+
+		for(size_t j = 0; j < size; ++j)
 		{
-			int index = i * size + j;
-			m_imageData[index] = (float)(255 -  imageData[index]) / 255.0f;
+			if(imageData[i * size + j] >= m_binaryThreshold)
+			{
+				bits[j >> 3] |= (byte)(1 << (j & 7));
+			}
 		}
 	}
 }
@@ -163,105 +493,805 @@ void CPUNeuralNet::loadLabelData(byte* labelData, int numLabels)
 	m_numLabels = numLabels;
 }
 
-void CPUNeuralNet::train(unsigned int numIterations, unsigned int miniBatchSize, float trainingRate)
+//Images by pixels of a fillInputBatch tile
+static const unsigned int TILE_SIZE = 16;
+
+/**
+ * out[k * outStride + j] = tile[j][k] for the first numImages rows and numPixels columns.
+ * Whole 4x4 blocks are transposed in SSE registers.
+*/
+static void transposeTile(const float tile[TILE_SIZE][TILE_SIZE], unsigned int numImages, unsigned int numPixels, float* out, size_t outStride)
 {
-	srand((unsigned int)time(0));
+	unsigned int fullImages = 0;
+
+#ifdef TRANSPOSE_SSE
+	fullImages = numImages & ~3u;
+	unsigned int fullPixels = numPixels & ~3u;
 
-	for(unsigned int iteration = 0; iteration < numIterations; ++iteration)
+	//Pixel blocks outside, so every output row is finished before the next four are started
+	for(unsigned int k = 0; k < fullPixels; k += 4)
 	{
-		for(unsigned int i = 0; i < m_numImages; i += miniBatchSize)
+		for(unsigned int j = 0; j < fullImages; j += 4)
 		{
-			unsigned int remaining = std::min(m_numImages - i, miniBatchSize);
-			Matrix inputLayerData(m_layers[0].getLayerSize(), remaining);
+			__m128 row0 = _mm_loadu_ps(&tile[j][k]);
+			__m128 row1 = _mm_loadu_ps(&tile[j + 1][k]);
+			__m128 row2 = _mm_loadu_ps(&tile[j + 2][k]);
+			__m128 row3 = _mm_loadu_ps(&tile[j + 3][k]);
+			_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
 
-			//Set input layer data
-			for(unsigned int j = 0; j < remaining; ++j)
-			{
-				unsigned int imageIndex = i + j;
-				unsigned int size = m_imageWidth * m_imageHeight;
+			_mm_storeu_ps(out + k * outStride + j, row0);
+			_mm_storeu_ps(out + (k + 1) * outStride + j, row1);
+			_mm_storeu_ps(out + (k + 2) * outStride + j, row2);
+			_mm_storeu_ps(out + (k + 3) * outStride + j, row3);
+		}
+	}
 
-				for(unsigned int k = 0; k < size; ++k)
-				{
-					inputLayerData.setValue(k, j, m_imageData[imageIndex * size + k]);
-				}
-			}
+	for(unsigned int k = fullPixels; k < numPixels; ++k)
+	{
+		for(unsigned int j = 0; j < fullImages; ++j)
+		{
+			out[k * outStride + j] = tile[j][k];
+		}
+	}
+#endif
+
+	for(unsigned int k = 0; k < numPixels; ++k)
+	{
+		for(unsigned int j = fullImages; j < numImages; ++j)
+		{
+			out[k * outStride + j] = tile[j][k];
+		}
+	}
+}
+
+/**
+ * Gathers and normalizes a batch from the stored bytes, 16 images at a time. Bytes are converted
+ * along each image into a 16x16 float tile, which is then transposed into the batch rows 4x4 at a
+ * time in SSE registers. Packed bits are gathered one byte per image and expanded straight into
+ * the 8 pixel rows they hold. The storage layout is checked once per batch instead of per pixel.
+*/
+void CPUNeuralNet::fillInputBatch(Matrix& inputLayerData, unsigned int firstImage, unsigned int count) const
+{
+	const unsigned int size = m_imageWidth * m_imageHeight;
+	const byte* images = m_imageData + (size_t)firstImage * m_imageStride;
 
-			std::vector<Matrix> weightedSums;
-			weightedSums.reserve(m_layers.size());
-			weightedSums.push_back(Matrix(1, 1).initValue(0));
+	float* data = inputLayerData.getData();
 
-			std::vector<Matrix> layerActivations;
-			layerActivations.reserve(m_layers.size());
-			layerActivations.push_back(inputLayerData);
+	if(m_loadedStorage == STORAGE_BINARY)
+	{
+		//Values of a cleared and a set bit
+		const float clearValue = normalizePixel(0);
+		const float setValue = normalizePixel(255);
 
-			Matrix previousActivations = inputLayerData;
+		for(unsigned int first = 0; first < size; first += 8)
+		{
+			unsigned int rowCount = std::min(8u, size - first);
 
-			//Forward propagation
-			for(int j = 1; j < m_layers.size(); ++j)
+			for(unsigned int group = 0; group < count; group += TILE_SIZE)
 			{
-				Matrix weightedSumStore(1, 1);
-				previousActivations = m_layers[j].calculateAcitvations(previousActivations, &weightedSumStore);
+				unsigned int groupCount = std::min(TILE_SIZE, count - group);
+
+				byte bits[TILE_SIZE] = {};
+				for(unsigned int j = 0; j < groupCount; ++j)
+				{
+					bits[j] = images[(size_t)(group + j) * m_imageStride + first / 8];
+				}
 
-				layerActivations.push_back(previousActivations);
-				weightedSums.push_back(weightedSumStore);
+				for(unsigned int bit = 0; bit < rowCount; ++bit)
+				{
+					float* row = data + (size_t)(first + bit) * count + group;
+
+					if(groupCount == TILE_SIZE)
+					{
+						for(unsigned int j = 0; j < TILE_SIZE; ++j)
+						{
+							row[j] = clearValue + (float)((bits[j] >> bit) & 1) * (setValue - clearValue);
+						}
+					}
+					else
+					{
+						for(unsigned int j = 0; j < groupCount; ++j)
+						{
+							row[j] = clearValue + (float)((bits[j] >> bit) & 1) * (setValue - clearValue);
+						}
+					}
+				}
 			}
+		}
 
-			//Compute cross-entropy loss
-			Matrix groundTruthData(m_layers[m_layers.size() - 1].getLayerSize(), remaining);
-			groundTruthData.apply([&](float value, int row, int column, int numRows, int numColumns) -> float {
-				return (m_labelData[i + column] == row) ? 1.0f : 0.0f;
-			});
+		return;
+	}
 
-			Matrix outputLosses = -1.0f / remaining * Matrix::sumAcross(groundTruthData * previousActivations.applyCopy(std::log10f) + (1 - groundTruthData) * (1 - previousActivations).applyCopy(std::log10f), AXIS_HORIZONTAL);
-			float totalCost = Matrix::sumAcross(outputLosses, AXIS_VERTICAL).getValue(0, 0);
+	float tile[TILE_SIZE][TILE_SIZE];
 
-			if ((m_numImages - i) <= miniBatchSize)
-			{
-				std::cout << "Total Cost[" << iteration << "]: " << totalCost << std::endl;
-			}
+	for(unsigned int first = 0; first < size; first += TILE_SIZE)
+	{
+		unsigned int tileWidth = std::min(TILE_SIZE, size - first);
+
+		for(unsigned int group = 0; group < count; group += TILE_SIZE)
+		{
+			unsigned int groupCount = std::min(TILE_SIZE, count - group);
 
-			//Backpropagation
-			Matrix outputDerivatives = -(groundTruthData / previousActivations - (1 - groundTruthData) / (1 - previousActivations));
-			
-			for(size_t j = m_layers.size() - 1; j >= 1; --j)
+			for(unsigned int j = 0; j < groupCount; ++j)
 			{
-				outputDerivatives = m_layers[j].gradientDescent(outputDerivatives, weightedSums[j], layerActivations[j - 1], trainingRate);
+				const byte* pixels = images + (size_t)(group + j) * m_imageStride + first;
+				float* values = tile[j];
+
+				for(unsigned int k = 0; k < tileWidth; ++k)
+				{
+					values[k] = normalizePixel(pixels[k]);
+				}
 			}
+
+			transposeTile(tile, groupCount, tileWidth, data + (size_t)first * count + group, count);
 		}
 	}
 }
 
-int CPUNeuralNet::test(byte* imageData) const
+Matrix CPUNeuralNet::groundTruthBatch(const byte* labels, unsigned int count) const
 {
-	Matrix inputLayerData(m_layers[0].getLayerSize(), 1);
+	Matrix groundTruthData(m_layers[m_layers.size() - 1].getLayerSize(), count);
+	groundTruthData.apply([&](float value, int row, int column, int numRows, int numColumns) -> float {
+		return (labels[column] == row) ? 1.0f : 0.0f;
+	});
 
-	//Set input layer data
-	unsigned int size = m_imageWidth * m_imageHeight;
-	for (unsigned int i = 0; i < size; ++i)
-	{
-		inputLayerData.setValue(i, 0, (float)(255 -  imageData[i]) / 255.0f);
-	}
+	return groundTruthData;
+}
 
+Matrix CPUNeuralNet::forwardPropagate(const std::vector<ConvLayer>& convLayers, const std::vector<NetworkLayer>& layers, const Matrix& inputLayerData)
+{
 	Matrix previousActivations = inputLayerData;
 
-	//Forward propagation
-	for (size_t i = 1; i < m_layers.size(); ++i)
+	for(const ConvLayer& layer : convLayers)
 	{
-		previousActivations = m_layers[i].calculateAcitvations(previousActivations, nullptr);
+		previousActivations = layer.calculateAcitvations(previousActivations, nullptr);
 	}
 
-	//Get the output value of the network
-	int maxIndex = 0;
-	float maxValue = 0.0f;
-	for (unsigned int i = 0; i < previousActivations.getRows(); ++i)
+	for(size_t i = 1; i < layers.size(); ++i)
 	{
-		float value = previousActivations.getValue(i, 0);
-		if (value > maxValue)
-		{
-			maxValue = value;
-			maxIndex = i;
-		}
+		previousActivations = layers[i].calculateAcitvations(previousActivations, nullptr);
 	}
 
-	return maxIndex;
+	return previousActivations;
+}
+
+float CPUNeuralNet::crossEntropyCost(FunctionType outputFunction, const Matrix& groundTruthData, const Matrix& outputActivations)
+{
+	Matrix y = groundTruthData;
+	Matrix a = outputActivations;
+
+	Matrix outputLosses(1, 1);
+
+	//Clamped like the derivatives, an output that underflowed to zero would make the cost infinite
+	auto clampedLog = [](float value) -> float { return log10f(std::max(value, 1e-7f)); };
+
+	if(outputFunction == FUNC_SOFTMAX)
+	{
+		//Categorical cross-entropy, the outputs are a single distribution
+		outputLosses = -1.0f / a.getColumns() * Matrix::sumAcross(y * a.applyCopy(clampedLog), AXIS_HORIZONTAL);
+	}
+	else
+	{
+		outputLosses = -1.0f / a.getColumns() * Matrix::sumAcross(y * a.applyCopy(clampedLog) + (1 - y) * (1 - a).applyCopy(clampedLog), AXIS_HORIZONTAL);
+	}
+
+	return Matrix::sumAcross(outputLosses, AXIS_VERTICAL).getValue(0, 0);
+}
+
+Matrix CPUNeuralNet::crossEntropyDerivatives(FunctionType outputFunction, const Matrix& groundTruthData, const Matrix& outputActivations)
+{
+	Matrix y = groundTruthData;
+	Matrix a = outputActivations;
+
+	if(outputFunction == FUNC_SOFTMAX)
+	{
+		//Only reached with dropout on the output, see NetworkLayer::fusesCrossEntropy. Clamped since softmax outputs can underflow to zero.
+		return -(y / a.applyCopy([](float value) -> float { return std::max(value, 1e-7f); }));
+	}
+
+	return -(y / a - (1 - y) / (1 - a));
+}
+
+/**
+ * Runs on the validation thread, only reads the image/label data and the given layers
+*/
+CPUNeuralNet::ValidationResult CPUNeuralNet::validate(const NetworkSnapshot& snapshot, unsigned int firstImage, unsigned int count) const
+{
+	const unsigned int batchSize = 1000;
+
+	ValidationResult result = { 0.0f, 0.0f };
+	unsigned int numCorrect = 0;
+
+	for(unsigned int i = 0; i < count; i += batchSize)
+	{
+		unsigned int remaining = std::min(count - i, batchSize);
+
+		Matrix inputLayerData(getInputSize(), remaining);
+		fillInputBatch(inputLayerData, firstImage + i, remaining);
+
+		Matrix outputActivations = forwardPropagate(snapshot.convLayers, snapshot.layers, inputLayerData);
+		result.cost += crossEntropyCost(snapshot.layers.back().getFunctionType(), groundTruthBatch(m_labelData + firstImage + i, remaining), outputActivations) * remaining;
+
+		for(unsigned int j = 0; j < remaining; ++j)
+		{
+			unsigned int maxIndex = 0;
+			for(unsigned int k = 1; k < outputActivations.getRows(); ++k)
+			{
+				if(outputActivations.getValue(k, j) > outputActivations.getValue(maxIndex, j))
+				{
+					maxIndex = k;
+				}
+			}
+
+			if(maxIndex == m_labelData[firstImage + i + j])
+			{
+				++numCorrect;
+			}
+		}
+	}
+
+	result.cost /= count;
+	result.accuracy = (float)numCorrect / count;
+
+	return result;
+}
+
+float CPUNeuralNet::scheduledLearningRate(float trainingRate, unsigned int iteration, unsigned int numIterations, float plateauScale) const
+{
+	const ValidationConfig& config = m_validationConfig;
+	float learningRate = trainingRate;
+
+	switch(config.schedule)
+	{
+	case SCHEDULE_STEP:
+		learningRate = trainingRate * powf(config.decayFactor, (float)(iteration / std::max(1u, config.stepInterval)));
+		break;
+	case SCHEDULE_COSINE:
+		learningRate = config.minLearningRate + 0.5f * (trainingRate - config.minLearningRate) * (1.0f + cosf(3.14159265f * iteration / numIterations));
+		break;
+	case SCHEDULE_PLATEAU:
+		learningRate = trainingRate * plateauScale;
+		break;
+	default:
+		break;
+	}
+
+	return std::max(learningRate, config.minLearningRate);
+}
+
+/**
+ * One forward and backward pass. Updates the weights layer by layer, or only stores the
+ * gradients when given somewhere to put them. In mixed precision mode every matrix kept
+ * for backpropagation is stored as bf16. The gradients passed between layers live for one
+ * layer only, so they stay fp32.
+ * Returns the cost when computeCost is set, 0 otherwise.
+*/
+float CPUNeuralNet::trainMiniBatch(const Matrix& inputLayerData, const Matrix& groundTruthData, float learningRate, uint64_t step, bool computeCost,
+	NetworkGradients* gradients)
+{
+	std::vector<ConvCache> convCaches(m_convLayers.size());
+	std::vector<LayerCache> layerCaches(m_layers.size());
+
+	//Inputs of every layer, only one of the two is filled per layer
+	std::vector<Matrix> storedActivations;
+	std::vector<BF16Matrix> packedActivations(m_convLayers.size() + m_layers.size());
+
+	Matrix previousActivations = inputLayerData;
+
+	auto storeActivations = [&]() {
+		if(m_mixedPrecision)
+		{
+			size_t index = storedActivations.size();
+			packedActivations[index] = BF16Matrix(previousActivations);
+
+			//Continue with the rounded values so both passes see the same activations
+			previousActivations = packedActivations[index].toMatrix();
+			storedActivations.push_back(Matrix(1, 1));
+		}
+		else
+		{
+			storedActivations.push_back(previousActivations);
+		}
+	};
+
+	auto loadActivations = [&](size_t index) -> Matrix {
+		return m_mixedPrecision ? packedActivations[index].toMatrix() : storedActivations[index];
+	};
+
+	//Forward propagation
+	for(size_t j = 0; j < m_convLayers.size(); ++j)
+	{
+		storeActivations();
+		previousActivations = m_convLayers[j].calculateAcitvations(previousActivations, &convCaches[j]);
+
+		if(m_mixedPrecision)
+		{
+			convCaches[j].pack();
+		}
+	}
+
+	for(size_t j = 1; j < m_layers.size(); ++j)
+	{
+		storeActivations();
+
+		layerCaches[j].dropoutStep = step;
+		previousActivations = m_layers[j].calculateAcitvations(previousActivations, &layerCaches[j]);
+
+		if(m_mixedPrecision)
+		{
+			layerCaches[j].pack();
+		}
+	}
+
+	FunctionType outputFunction = m_layers.back().getFunctionType();
+	float cost = computeCost ? crossEntropyCost(outputFunction, groundTruthData, previousActivations) : 0.0f;
+
+	//Backpropagation
+	bool fused = m_layers.back().fusesCrossEntropy();
+	Matrix outputDerivatives = fused ? previousActivations - groundTruthData : crossEntropyDerivatives(outputFunction, groundTruthData, previousActivations);
+	size_t activationIndex = storedActivations.size();
+
+	for(size_t j = m_layers.size() - 1; j >= 1; --j)
+	{
+		bool weightedSumDerivatives = fused && j == m_layers.size() - 1;
+
+		if(layerCaches[j].packed)
+		{
+			layerCaches[j].unpack();
+		}
+
+		Matrix previousLayerActivations = loadActivations(--activationIndex);
+
+		if(gradients)
+		{
+			outputDerivatives = m_layers[j].computeGradients(outputDerivatives, layerCaches[j], previousLayerActivations, gradients->layers[j], weightedSumDerivatives);
+		}
+		else
+		{
+			outputDerivatives = m_layers[j].gradientDescent(outputDerivatives, layerCaches[j], previousLayerActivations, learningRate, weightedSumDerivatives);
+		}
+	}
+
+	for(size_t j = m_convLayers.size(); j-- > 0;)
+	{
+		if(convCaches[j].packed)
+		{
+			convCaches[j].unpack();
+		}
+
+		Matrix previousLayerActivations = loadActivations(--activationIndex);
+
+		if(gradients)
+		{
+			outputDerivatives = m_convLayers[j].computeGradients(outputDerivatives, convCaches[j], previousLayerActivations, gradients->convLayers[j]);
+		}
+		else
+		{
+			outputDerivatives = m_convLayers[j].gradientDescent(outputDerivatives, convCaches[j], previousLayerActivations, learningRate);
+		}
+	}
+
+	return cost;
+}
+
+void CPUNeuralNet::applyGradients(const NetworkGradients& gradients, float learningRate)
+{
+	for(size_t j = 0; j < m_convLayers.size(); ++j)
+	{
+		m_convLayers[j].applyGradients(gradients.convLayers[j], learningRate);
+	}
+
+	for(size_t j = 1; j < m_layers.size(); ++j)
+	{
+		m_layers[j].applyGradients(gradients.layers[j], learningRate);
+	}
+}
+
+/**
+ * One epoch of Hogwild training. Minibatch i keeps the dropout step it has in the serial
+ * trainer, only the order in which the updates land differs between runs.
+ * Workers are spread over the NUMA nodes and take minibatches from their node's image
+ * shard first, then from the other shards once theirs is used up.
+ * Returns the cost of the last minibatch.
+*/
+float CPUNeuralNet::trainEpochAsync(unsigned int numTraining, unsigned int miniBatchSize, float learningRate)
+{
+	const unsigned int numBatches = (numTraining + miniBatchSize - 1) / miniBatchSize;
+	const unsigned int maxStaleness = m_asyncConfig.maxStaleness;
+	const Topology& topology = Topology::get();
+
+	//Minibatches [shardBatches[s], shardBatches[s + 1]) start inside shard s
+	std::vector<unsigned int> shardBatches(m_numShards + 1, numBatches);
+	std::unique_ptr<std::atomic<unsigned int>[]> nextBatch(new std::atomic<unsigned int>[m_numShards]);
+
+	for(unsigned int s = 0; s < m_numShards; ++s)
+	{
+		shardBatches[s] = std::min(numBatches, (getShardBegin(s) + miniBatchSize - 1) / miniBatchSize);
+		nextBatch[s] = shardBatches[s];
+	}
+
+	auto takeBatch = [&](size_t homeShard, unsigned int& batch) -> bool {
+		for(unsigned int s = 0; s < m_numShards; ++s)
+		{
+			size_t shard = (homeShard + s) % m_numShards;
+
+			batch = nextBatch[shard]++;
+			if(batch < shardBatches[shard + 1])
+			{
+				return true;
+			}
+		}
+
+		return false;
+	};
+
+	std::atomic<uint64_t> numUpdates(0);
+	std::atomic<unsigned int> numDropped(0);
+	float lastCost = 0.0f;
+
+	auto worker = [&](unsigned int workerIndex) {
+		size_t node = topology.getWorkerNode(workerIndex);
+		if(m_asyncConfig.pinThreads)
+		{
+			topology.pinCurrentThread(node);
+		}
+
+		//Allocated after pinning, so activation buffers are first touched on the worker's node
+		NetworkGradients gradients;
+		gradients.convLayers.resize(m_convLayers.size());
+		gradients.layers.resize(m_layers.size());
+
+		unsigned int batch;
+		while(takeBatch(node % m_numShards, batch))
+		{
+			unsigned int first = batch * miniBatchSize;
+			unsigned int count = std::min(numTraining - first, miniBatchSize);
+
+			Matrix inputLayerData(getInputSize(), count);
+			fillInputBatch(inputLayerData, first, count);
+			Matrix groundTruthData = groundTruthBatch(m_labelData + first, count);
+
+			bool lastBatch = (batch + 1 == numBatches);
+			uint64_t readVersion = numUpdates.load();
+
+			float cost = trainMiniBatch(inputLayerData, groundTruthData, learningRate, m_trainingStep + batch, lastBatch, &gradients);
+			if(lastBatch)
+			{
+				lastCost = cost;
+			}
+
+			if(maxStaleness > 0 && numUpdates.load() - readVersion > maxStaleness)
+			{
+				++numDropped;
+				continue;
+			}
+
+			applyGradients(gradients, learningRate);
+			++numUpdates;
+		}
+	};
+
+	//The calling thread only waits, pinning it would outlive the epoch
+	std::vector<std::thread> threads;
+	for(unsigned int t = 0; t < m_asyncConfig.numThreads; ++t)
+	{
+		threads.push_back(std::thread(worker, t));
+	}
+
+	for(std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	m_trainingStep += numBatches;
+
+	if(numDropped > 0)
+	{
+		std::cout << "Dropped " << numDropped << " of " << numBatches << " stale minibatches" << std::endl;
+	}
+
+	return lastCost;
+}
+
+void CPUNeuralNet::train(unsigned int numIterations, unsigned int miniBatchSize, float trainingRate)
+{
+	const ValidationConfig& config = m_validationConfig;
+
+	//The validation split is taken from the end of the loaded data
+	unsigned int numValidation = std::min((unsigned int)(m_numImages * config.validationFraction), m_numImages - 1);
+	unsigned int numTraining = m_numImages - numValidation;
+	unsigned int evaluationInterval = std::max(1u, config.evaluationInterval);
+
+	typedef std::shared_ptr<const NetworkSnapshot> Snapshot;
+
+	std::future<ValidationResult> pendingValidation;
+	Snapshot pendingSnapshot;
+	unsigned int pendingIteration = 0;
+
+	Snapshot bestSnapshot;
+	float bestCost = std::numeric_limits<float>::max();
+	unsigned int numStaleValidations = 0;
+	unsigned int numPlateauValidations = 0;
+	float plateauScale = 1.0f;
+	bool stopTraining = false;
+
+	//Returns true when training should stop
+	auto collectValidation = [&]() -> bool {
+		ValidationResult result = pendingValidation.get();
+		std::cout << "Validation[" << pendingIteration << "]: cost " << result.cost << ", accuracy " << (result.accuracy * 100) << "%" << std::endl;
+
+		if(result.cost < bestCost - config.minImprovement)
+		{
+			bestCost = result.cost;
+			bestSnapshot = pendingSnapshot;
+			numStaleValidations = 0;
+			numPlateauValidations = 0;
+		}
+		else
+		{
+			++numStaleValidations;
+
+			if(config.schedule == SCHEDULE_PLATEAU && ++numPlateauValidations >= config.plateauPatience)
+			{
+				plateauScale *= config.decayFactor;
+				numPlateauValidations = 0;
+			}
+		}
+
+		pendingSnapshot.reset();
+
+		return config.patience > 0 && numStaleValidations >= config.patience;
+	};
+
+	for(unsigned int iteration = 0; iteration < numIterations && !stopTraining; ++iteration)
+	{
+		float learningRate = scheduledLearningRate(trainingRate, iteration, numIterations, plateauScale);
+
+		if(m_asyncConfig.numThreads > 1)
+		{
+			float totalCost = trainEpochAsync(numTraining, miniBatchSize, learningRate);
+			std::cout << "Total Cost[" << iteration << "]: " << totalCost << std::endl;
+		}
+		else
+		{
+			for(unsigned int i = 0; i < numTraining; i += miniBatchSize)
+			{
+				unsigned int remaining = std::min(numTraining - i, miniBatchSize);
+				Matrix inputLayerData(getInputSize(), remaining);
+
+				//Set input layer data
+				fillInputBatch(inputLayerData, i, remaining);
+
+				Matrix groundTruthData = groundTruthBatch(m_labelData + i, remaining);
+
+				if ((numTraining - i) <= miniBatchSize)
+				{
+					float totalCost = trainMiniBatch(inputLayerData, groundTruthData, learningRate, m_trainingStep, true);
+					std::cout << "Total Cost[" << iteration << "]: " << totalCost << std::endl;
+				}
+				else
+				{
+					trainMiniBatch(inputLayerData, groundTruthData, learningRate, m_trainingStep, false);
+				}
+
+				++m_trainingStep;
+			}
+		}
+
+		bool lastIteration = (iteration + 1 == numIterations);
+		if(numValidation > 0 && ((iteration + 1) % evaluationInterval == 0 || lastIteration))
+		{
+			//The previous run had a whole evaluation interval to finish, so this rarely blocks
+			if(pendingValidation.valid())
+			{
+				stopTraining = collectValidation();
+			}
+
+			pendingSnapshot = std::make_shared<NetworkSnapshot>(takeSnapshot());
+			pendingIteration = iteration;
+
+			Snapshot snapshot = pendingSnapshot;
+			pendingValidation = std::async(std::launch::async, [this, snapshot, numTraining, numValidation]() {
+				return validate(*snapshot, numTraining, numValidation);
+			});
+		}
+	}
+
+	if(pendingValidation.valid())
+	{
+		collectValidation();
+	}
+
+	//Restore the best checkpoint
+	if(bestSnapshot)
+	{
+		restoreSnapshot(*bestSnapshot);
+	}
+}
+
+CPUNeuralNet::NetworkSnapshot CPUNeuralNet::takeSnapshot() const
+{
+	NetworkSnapshot snapshot;
+
+	for(const ConvLayer& layer : m_convLayers)
+	{
+		snapshot.convLayers.push_back(layer.clone());
+	}
+
+	for(const NetworkLayer& layer : m_layers)
+	{
+		snapshot.layers.push_back(layer.clone());
+	}
+
+	return snapshot;
+}
+
+void CPUNeuralNet::restoreSnapshot(const NetworkSnapshot& snapshot)
+{
+	m_convLayers.clear();
+	for(const ConvLayer& layer : snapshot.convLayers)
+	{
+		m_convLayers.push_back(layer.clone());
+	}
+
+	m_layers.clear();
+	for(const NetworkLayer& layer : snapshot.layers)
+	{
+		m_layers.push_back(layer.clone());
+	}
+}
+
+int CPUNeuralNet::test(byte* imageData) const
+{
+	Matrix inputLayerData(getInputSize(), 1);
+
+	//Set input layer data, the network may only have been trained through partialFit
+	unsigned int size = getInputSize();
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		inputLayerData.setValue(i, 0, normalizePixel(imageData[i]));
+	}
+
+	//Forward propagation
+	Matrix previousActivations = forwardPropagate(m_convLayers, m_layers, inputLayerData);
+
+	//Get the output value of the network
+	//Seeded from the first output, tanh, leaky ReLU and GELU outputs can all be negative
+	int maxIndex = 0;
+	float maxValue = previousActivations.getValue(0, 0);
+	for (unsigned int i = 1; i < previousActivations.getRows(); ++i)
+	{
+		float value = previousActivations.getValue(i, 0);
+		if (value > maxValue)
+		{
+			maxValue = value;
+			maxIndex = i;
+		}
+	}
+
+	return maxIndex;
+}
+
+void CPUNeuralNet::setOnlineConfig(const OnlineConfig& config)
+{
+	m_onlineConfig = config;
+
+	m_velocity = NetworkGradients();
+	m_replayImages.clear();
+	m_replayLabels.clear();
+	m_replayNext = 0;
+}
+
+float CPUNeuralNet::partialFit(const byte* imageData, const byte* labelData, unsigned int count)
+{
+	const OnlineConfig& config = m_onlineConfig;
+	const unsigned int size = getInputSize();
+
+	//Replayed samples are drawn before the new ones enter the buffer
+	unsigned int numStored = (unsigned int)m_replayLabels.size();
+	unsigned int numReplayed = (numStored > 0) ? config.replaySamples : 0;
+	unsigned int batchSize = count + numReplayed;
+
+	//Nothing arrived and nothing to replay, the model stays as it is
+	if(batchSize == 0)
+	{
+		return 0.0f;
+	}
+
+	Matrix inputLayerData(size, batchSize);
+	std::vector<byte> labels(labelData, labelData + count);
+	Philox generator(config.seed);
+
+	for(unsigned int j = 0; j < batchSize; ++j)
+	{
+		const byte* image = imageData + (size_t)j * size;
+
+		if(j >= count)
+		{
+			unsigned int sample = std::min(numStored - 1, (unsigned int)(generator.uniform(m_trainingStep, j - count) * numStored));
+
+			image = m_replayImages.data() + (size_t)sample * size;
+			labels.push_back(m_replayLabels[sample]);
+		}
+
+		for(unsigned int k = 0; k < size; ++k)
+		{
+			inputLayerData.setValue(k, j, normalizePixel(image[k]));
+		}
+	}
+
+	NetworkGradients gradients;
+	gradients.convLayers.resize(m_convLayers.size());
+	gradients.layers.resize(m_layers.size());
+
+	float cost = trainMiniBatch(inputLayerData, groundTruthBatch(labels.data(), batchSize), config.learningRate, m_trainingStep, true, &gradients);
+
+	//Heavy ball momentum, velocity = momentum * velocity + gradient
+	bool firstUpdate = m_velocity.layers.empty();
+	if(firstUpdate)
+	{
+		m_velocity.convLayers.resize(m_convLayers.size());
+		m_velocity.layers.resize(m_layers.size());
+	}
+
+	auto accumulate = [&](Matrix& velocity, const Matrix& gradient) {
+		if(firstUpdate)
+		{
+			velocity = gradient.copy();
+		}
+		else
+		{
+			velocity.apply([&](float value) -> float { return config.momentum * value; }).addScaled(gradient, 1.0f);
+		}
+	};
+
+	for(size_t j = 0; j < m_convLayers.size(); ++j)
+	{
+		accumulate(m_velocity.convLayers[j].weights, gradients.convLayers[j].weights);
+		accumulate(m_velocity.convLayers[j].biases, gradients.convLayers[j].biases);
+	}
+
+	for(size_t j = 1; j < m_layers.size(); ++j)
+	{
+		LayerGradients& velocity = m_velocity.layers[j];
+		const LayerGradients& layerGradients = gradients.layers[j];
+
+		accumulate(velocity.weights, layerGradients.weights);
+		accumulate(velocity.biases, layerGradients.biases);
+
+		if(m_layers[j].hasBatchNorm())
+		{
+			accumulate(velocity.gamma, layerGradients.gamma);
+			accumulate(velocity.beta, layerGradients.beta);
+
+			//The running averages follow the latest batch only
+			velocity.batchMean = layerGradients.batchMean;
+			velocity.batchVariance = layerGradients.batchVariance;
+		}
+	}
+
+	applyGradients(m_velocity, config.learningRate);
+	++m_trainingStep;
+
+	//Ring buffer, the oldest samples are overwritten once it is full
+	for(unsigned int j = 0; j < count && config.replayCapacity > 0; ++j)
+	{
+		if(m_replayLabels.size() < config.replayCapacity)
+		{
+			m_replayImages.insert(m_replayImages.end(), imageData + (size_t)j * size, imageData + (size_t)(j + 1) * size);
+			m_replayLabels.push_back(labelData[j]);
+			continue;
+		}
+
+		memcpy(m_replayImages.data() + (size_t)m_replayNext * size, imageData + (size_t)j * size, size);
+		m_replayLabels[m_replayNext] = labelData[j];
+		m_replayNext = (m_replayNext + 1) % config.replayCapacity;
+	}
+
+	return cost;
+}
+
+std::shared_ptr<const InferenceModel> CPUNeuralNet::exportModel() const
+{
+	return std::make_shared<InferenceModel>(m_convLayers, m_layers);
 }
\ No newline at end of file
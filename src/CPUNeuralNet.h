@@ -2,15 +2,164 @@
 
 #include "NeuralNet.h"
 #include "Matrix.h"
+#include "Activations.h"
+#include "ConvLayer.h"
+#include "Random.h"
+#include "BFloat16.h"
 
 #include <vector>
 #include <algorithm>
 #include <memory>
 
-enum FunctionType
+class InferenceModel;
+
+inline float normalizePixel(byte value)
+{
+	return (float)(255 - value) / 255.0f;
+}
+
+enum ImageStorage
+{
+	STORAGE_UINT8,	//Pixels are kept as loaded and normalized while a batch is gathered
+	STORAGE_BINARY	//One bit per pixel, set when the pixel reaches the binarization threshold
+};
+
+enum LearningRateSchedule
+{
+	SCHEDULE_CONSTANT,
+	SCHEDULE_STEP,
+	SCHEDULE_COSINE,
+	SCHEDULE_PLATEAU
+};
+
+enum PruningType
+{
+	PRUNE_MAGNITUDE,	//Individual weights with the smallest magnitude
+	PRUNE_BLOCK			//BlockSparseMatrix blocks with the smallest mean magnitude, so the sparse kernels skip them
+};
+
+/**
+ * Controls the held-out validation split used by CPUNeuralNet::train.
+ * Validation runs on a background thread against a snapshot of the weights, so
+ * its result is consumed one evaluation interval after it was started.
+*/
+struct ValidationConfig
+{
+	float validationFraction = 0.0f;		//Fraction of the loaded images held out for validation, 0 disables validation
+	unsigned int evaluationInterval = 1;	//Epochs between validation runs
+	unsigned int patience = 0;				//Validation runs without improvement before training stops, 0 disables early stopping
+	float minImprovement = 0.0f;			//Minimum decrease in validation cost that counts as an improvement
+
+	LearningRateSchedule schedule = SCHEDULE_CONSTANT;
+	unsigned int stepInterval = 50;			//SCHEDULE_STEP: epochs between decays
+	unsigned int plateauPatience = 3;		//SCHEDULE_PLATEAU: validation runs without improvement before decaying
+	float decayFactor = 0.5f;				//SCHEDULE_STEP, SCHEDULE_PLATEAU: learning rate multiplier per decay
+	float minLearningRate = 0.0f;
+};
+
+/**
+ * Hogwild training used by CPUNeuralNet::train. Worker threads pull minibatches from a
+ * shared counter and apply their updates to the shared weights without locking, so a
+ * gradient may be computed from weights other workers have updated in the meantime.
+*/
+struct AsyncConfig
 {
-	FUNC_RELU,
-	FUNC_SIGMOID
+	unsigned int numThreads = 1;	//1 keeps the serial trainer
+	unsigned int maxStaleness = 0;	//Updates by other workers a gradient may lag behind before it is dropped, 0 disables the bound
+	bool pinThreads = true;			//Restricts each worker to the cores of its NUMA node, see Topology
+};
+
+/**
+ * Settings of CPUNeuralNet::partialFit
+*/
+struct OnlineConfig
+{
+	float learningRate = 0.01f;
+	float momentum = 0.9f;				//Fraction of the previous update carried into the next one, 0 for plain SGD
+	unsigned int replayCapacity = 0;	//Past samples kept for rehearsal, 0 disables the replay buffer
+	unsigned int replaySamples = 0;		//Samples drawn from the replay buffer and added to every update
+	uint64_t seed = 0;					//Selects the replayed samples
+};
+
+/**
+ * Describes one fully connected layer. Dropout and batch normalization only affect
+ * training, both disappear when the layer is exported to an InferenceModel.
+*/
+struct LayerDesc
+{
+	int layerSize;
+	FunctionType functionType;
+	float dropoutRate;	//Probability of zeroing an activation while training
+	bool batchNorm;		//Normalize the weighted sums before the activation function
+
+	LayerDesc(int layerSize, FunctionType functionType = FUNC_RELU, float dropoutRate = 0.0f, bool batchNorm = false) :
+		layerSize(layerSize), functionType(functionType), dropoutRate(dropoutRate), batchNorm(batchNorm)
+	{ }
+};
+
+/**
+ * Values of a training forward pass needed again by NetworkLayer::gradientDescent
+*/
+struct LayerCache
+{
+	Matrix weightedSums;		//Input of the activation function (after batch normalization)
+	Matrix normalizedSums;		//Batch normalization only
+	Matrix batchMean;			//Batch normalization only
+	Matrix batchVariance;		//Batch normalization only
+	Matrix dropoutMask;			//Dropout only, already scaled by 1 / keep probability
+
+	uint64_t dropoutStep = 0; //Selects the dropout stream, use a different value for every training step
+
+	//Mixed precision storage of the per-example matrices while the cache waits for backpropagation
+	BF16Matrix packedWeightedSums;
+	BF16Matrix packedNormalizedSums;
+	bool packed = false;
+
+	LayerCache() :
+		weightedSums(1, 1), normalizedSums(1, 1), batchMean(1, 1), batchVariance(1, 1), dropoutMask(1, 1)
+	{ }
+
+	/**
+	 * Moves the per-example matrices into bf16 storage. The batch statistics and the dropout
+	 * mask stay fp32, bf16 would round 1 / keep probability and scale the backward pass differently.
+	*/
+	inline void pack()
+	{
+		packedWeightedSums = BF16Matrix(weightedSums);
+		packedNormalizedSums = BF16Matrix(normalizedSums);
+
+		weightedSums = Matrix(1, 1);
+		normalizedSums = Matrix(1, 1);
+		packed = true;
+	}
+
+	inline void unpack()
+	{
+		weightedSums = packedWeightedSums.toMatrix();
+		normalizedSums = packedNormalizedSums.toMatrix();
+
+		packedWeightedSums = BF16Matrix();
+		packedNormalizedSums = BF16Matrix();
+		packed = false;
+	}
+};
+
+/**
+ * Parameter gradients of one minibatch, already averaged over its examples.
+ * The batch statistics feed the running averages of batch normalization.
+*/
+struct LayerGradients
+{
+	Matrix weights;
+	Matrix biases;
+	Matrix gamma;
+	Matrix beta;
+	Matrix batchMean;
+	Matrix batchVariance;
+
+	LayerGradients() :
+		weights(1, 1), biases(1, 1), gamma(1, 1), beta(1, 1), batchMean(1, 1), batchVariance(1, 1)
+	{ }
 };
 
 class NetworkLayer
@@ -19,60 +168,280 @@ private:
 	Matrix m_weights;
 	Matrix m_biases;
 
+	//Batch normalization parameters, (m_layerSize, 1)
+	Matrix m_gamma;
+	Matrix m_beta;
+	Matrix m_runningMean;
+	Matrix m_runningVariance;
+
 	int m_layerSize = 0;
 	int m_previousLayerSize = 0;
 
 	FunctionType m_functionType;
+	float m_dropoutRate = 0.0f;
+	bool m_batchNorm = false;
+
+	uint64_t m_seed = 0; //Stream 0 initializes the weights, the other streams hold dropout masks
+
+	//1 for kept weights and 0 for pruned ones, only allocated once the layer is pruned
+	Matrix m_pruningMask;
+	bool m_pruned = false;
+private:
+	void applyPruningMask();
+
+	static const float BATCH_NORM_EPSILON;
+	static const float BATCH_NORM_MOMENTUM;
 public:
+	NetworkLayer(const LayerDesc& desc, int previousLayerSize) :
+		m_layerSize(desc.layerSize), m_previousLayerSize(previousLayerSize),
+		m_weights(desc.layerSize, std::max(1, previousLayerSize)), m_biases(desc.layerSize, 1),
+		m_gamma(desc.layerSize, 1), m_beta(desc.layerSize, 1), m_runningMean(desc.layerSize, 1), m_runningVariance(desc.layerSize, 1),
+		m_functionType(desc.functionType), m_dropoutRate(desc.dropoutRate), m_batchNorm(desc.batchNorm),
+		m_pruningMask(1, 1)
+	{
+		m_gamma.initValue(1);
+		m_beta.initValue(0);
+		m_runningMean.initValue(0);
+		m_runningVariance.initValue(1);
+	}
+
 	NetworkLayer(int layerSize, int previousLayerSize, FunctionType functionType) :
-		m_layerSize(layerSize), m_previousLayerSize(previousLayerSize),
-		m_weights(layerSize, std::max(1, previousLayerSize)), m_biases(layerSize, 1),
-		m_functionType(functionType)
+		NetworkLayer(LayerDesc(layerSize, functionType), previousLayerSize)
 	{ }
 
 	NetworkLayer(const NetworkLayer& other) :
 		m_layerSize(other.m_layerSize), m_previousLayerSize(other.m_previousLayerSize),
 		m_weights(other.m_weights), m_biases(other.m_biases),
-		m_functionType(other.m_functionType)
+		m_gamma(other.m_gamma), m_beta(other.m_beta), m_runningMean(other.m_runningMean), m_runningVariance(other.m_runningVariance),
+		m_functionType(other.m_functionType), m_dropoutRate(other.m_dropoutRate), m_batchNorm(other.m_batchNorm),
+		m_seed(other.m_seed), m_pruningMask(other.m_pruningMask), m_pruned(other.m_pruned)
 	{}
 
 	~NetworkLayer() {}
 
-	void initWeightsAndBiases(float weightRangeStart, float weightRangeEnd, float biasRangeStart, float biasRangeEnd);
-	Matrix calculateAcitvations(const Matrix& previousActivations, Matrix* weightedSumStore) const;
-	Matrix gradientDescent(const Matrix& activationDerivatives, const Matrix& weightedSums, const Matrix& previousLayerActivations, float learningRate);
+	/**
+	 * Deep copy, the copy constructor shares the weight buffers
+	*/
+	inline NetworkLayer clone() const
+	{
+		NetworkLayer layer(*this);
+		layer.m_weights = m_weights.copy();
+		layer.m_biases = m_biases.copy();
+		layer.m_gamma = m_gamma.copy();
+		layer.m_beta = m_beta.copy();
+		layer.m_runningMean = m_runningMean.copy();
+		layer.m_runningVariance = m_runningVariance.copy();
+		layer.m_pruningMask = m_pruningMask.copy();
+
+		return layer;
+	}
+
+	void initWeightsAndBiases(float weightRangeStart, float weightRangeEnd, float biasRangeStart, float biasRangeEnd, uint64_t seed);
+	void initWeights(WeightInit scheme, uint64_t seed);
+
+	/**
+	 * Passing a cache runs the layer in training mode, using batch statistics and dropout.
+	 * Without one the running statistics are used and dropout is skipped.
+	*/
+	Matrix calculateAcitvations(const Matrix& previousActivations, LayerCache* cache) const;
+	Matrix gradientDescent(const Matrix& activationDerivatives, const LayerCache& cache, const Matrix& previousLayerActivations, float learningRate,
+		bool weightedSumDerivatives = false);
+
+	/**
+	 * Zeroes the weights until the given fraction of them is pruned. Pruned weights stay
+	 * zero through later training, so the remaining ones can be fine-tuned.
+	*/
+	void prune(float sparsity, PruningType type);
+	float getSparsity() const;
+
+	/**
+	 * gradientDescent split in two for asynchronous training. Returns the derivatives
+	 * of the previous layer's activations.
+	 * With weightedSumDerivatives the derivatives are already taken with respect to the input
+	 * of the activation function, like the fused softmax cross-entropy gradient.
+	*/
+	Matrix computeGradients(const Matrix& activationDerivatives, const LayerCache& cache, const Matrix& previousLayerActivations, LayerGradients& gradients,
+		bool weightedSumDerivatives = false) const;
+
+	/**
+	 * Softmax outputs trained with cross-entropy take the derivative a - y of the weighted sums
+	 * directly. Going through -y / a and the softmax Jacobian vanishes once a underflows.
+	 * Dropout on the output scales a after the softmax, so it keeps the separate path.
+	*/
+	inline bool fusesCrossEntropy() const { return m_functionType == FUNC_SOFTMAX && m_dropoutRate == 0.0f; }
+
+	/**
+	 * Updates the parameters in place, so concurrent readers never see a reallocated buffer
+	*/
+	void applyGradients(const LayerGradients& gradients, float learningRate);
+
+	/**
+	 * Weights and biases with batch normalization folded in, for inference
+	*/
+	void foldedWeightsAndBiases(Matrix& weights, Matrix& biases) const;
 
 	inline int getLayerSize() const { return m_layerSize; }
+	inline FunctionType getFunctionType() const { return m_functionType; }
+	inline float getDropoutRate() const { return m_dropoutRate; }
+	inline bool hasBatchNorm() const { return m_batchNorm; }
 
 	inline Matrix& getWeights() { return m_weights; }
 	inline const Matrix& getWeights() const { return m_weights; }
 
 	inline Matrix& getBiases() { return m_biases; }
 	inline const Matrix& getBiases() const { return m_biases; }
+
+	inline Matrix& getGamma() { return m_gamma; }
+	inline Matrix& getBeta() { return m_beta; }
 };
 
 class CPUNeuralNet : public NeuralNet
 {
 private:
-	float* m_imageData = nullptr;
+	byte* m_imageData = nullptr;
 	byte* m_labelData = nullptr;
 
+	ImageStorage m_imageStorage = STORAGE_UINT8;	//Used by the next loadImageData call
+	ImageStorage m_loadedStorage = STORAGE_UINT8;	//Layout of m_imageData
+	byte m_binaryThreshold = 128;
+
 	unsigned int m_imageWidth = 0;
 	unsigned int m_imageHeight = 0;
+	unsigned int m_imageStride = 0; //Bytes per stored image
 	unsigned int m_numImages = 0;
+	unsigned int m_numShards = 1; //Contiguous image ranges, one per NUMA node
 	int m_numLabels = 0;
 
+	//Applied in order before the dense layers, m_layers[0] holds their flattened output
+	std::vector<ConvLayer> m_convLayers;
 	std::vector<NetworkLayer> m_layers;
+
+	ValidationConfig m_validationConfig;
+	uint64_t m_trainingStep = 0;
+
+	bool m_mixedPrecision = false;
+	AsyncConfig m_asyncConfig;
 private:
-	
+	struct ValidationResult
+	{
+		float cost;
+		float accuracy;
+	};
+
+	/**
+	 * Deep copy of every layer, used for validation and best checkpoints
+	*/
+	struct NetworkSnapshot
+	{
+		std::vector<ConvLayer> convLayers;
+		std::vector<NetworkLayer> layers;
+	};
+
+	struct NetworkGradients
+	{
+		std::vector<ConvGradients> convLayers;
+		std::vector<LayerGradients> layers;
+	};
+
+	//partialFit state, reset by setOnlineConfig
+	OnlineConfig m_onlineConfig;
+	NetworkGradients m_velocity;		//Empty until the first update
+	std::vector<byte> m_replayImages;	//Raw pixels, getInputSize() bytes per sample
+	std::vector<byte> m_replayLabels;
+	unsigned int m_replayNext = 0;		//Slot overwritten next once the buffer is full
+
+	void storeImages(const byte* imageData, unsigned int firstImage, unsigned int count);
+	inline unsigned int getShardBegin(unsigned int shard) const { return (unsigned int)((uint64_t)m_numImages * shard / m_numShards); }
+
+	void fillInputBatch(Matrix& inputLayerData, unsigned int firstImage, unsigned int count) const;
+	Matrix groundTruthBatch(const byte* labels, unsigned int count) const;
+	ValidationResult validate(const NetworkSnapshot& snapshot, unsigned int firstImage, unsigned int count) const;
+	float trainMiniBatch(const Matrix& inputLayerData, const Matrix& groundTruthData, float learningRate, uint64_t step, bool computeCost,
+		NetworkGradients* gradients = nullptr);
+	void applyGradients(const NetworkGradients& gradients, float learningRate);
+	float trainEpochAsync(unsigned int numTraining, unsigned int miniBatchSize, float learningRate);
+	float scheduledLearningRate(float trainingRate, unsigned int iteration, unsigned int numIterations, float plateauScale) const;
+
+	NetworkSnapshot takeSnapshot() const;
+	void restoreSnapshot(const NetworkSnapshot& snapshot);
+
+	static Matrix forwardPropagate(const std::vector<ConvLayer>& convLayers, const std::vector<NetworkLayer>& layers, const Matrix& inputLayerData);
+	static float crossEntropyCost(FunctionType outputFunction, const Matrix& groundTruthData, const Matrix& outputActivations);
+	static Matrix crossEntropyDerivatives(FunctionType outputFunction, const Matrix& groundTruthData, const Matrix& outputActivations);
 public:
-	CPUNeuralNet(int* layerSizes, int numLayers);
+	CPUNeuralNet(int* layerSizes, int numLayers, uint64_t seed = 0);
+	explicit CPUNeuralNet(const std::vector<LayerDesc>& layers, uint64_t seed = 0);
+
+	/**
+	 * Convolutional network, layers only lists the dense layers after the convolutions
+	*/
+	CPUNeuralNet(const ConvShape& inputShape, const std::vector<ConvLayerDesc>& convLayers, const std::vector<LayerDesc>& layers, uint64_t seed = 0);
 	~CPUNeuralNet();
 
+	/**
+	 * Reinitializes every layer, each one draws from its own stream derived from the seed
+	*/
+	void initWeights(uint64_t seed, WeightInit scheme = INIT_AUTO);
+
+	/**
+	 * Prunes every dense layer to the given sparsity, train afterwards to fine-tune the
+	 * remaining weights. Convolution layers are left dense.
+	*/
+	void prune(float sparsity, PruningType type = PRUNE_MAGNITUDE);
+
+	/**
+	 * Dense layers, the first one only holds the input size
+	*/
+	inline const std::vector<NetworkLayer>& getLayers() const { return m_layers; }
+
+	/**
+	 * Takes effect on the next loadImageData call. Binary storage trains on thresholded
+	 * images, so inference inputs should be thresholded the same way.
+	*/
+	inline void setImageStorage(ImageStorage storage, byte binaryThreshold = 128) { m_imageStorage = storage; m_binaryThreshold = binaryThreshold; }
+
 	void loadImageData(byte* imageData, int width, int height, int numImage) override;
 	void loadLabelData(byte* labelData, int numLabels) override;
 
+	inline int getInputSize() const { return m_convLayers.empty() ? m_layers[0].getLayerSize() : m_convLayers[0].getInputShape().size(); }
+
+	inline void setValidationConfig(const ValidationConfig& config) { m_validationConfig = config; }
+	inline const ValidationConfig& getValidationConfig() const { return m_validationConfig; }
+
+	/**
+	 * Keeps the activations and cached layer values held for backpropagation in bf16 while
+	 * training. Weights, gradients, weight updates and matrix products stay fp32.
+	*/
+	inline void setMixedPrecision(bool enabled) { m_mixedPrecision = enabled; }
+	inline bool getMixedPrecision() const { return m_mixedPrecision; }
+
+	inline void setAsyncConfig(const AsyncConfig& config) { m_asyncConfig = config; }
+	inline const AsyncConfig& getAsyncConfig() const { return m_asyncConfig; }
+
 	void train(unsigned int numIteration, unsigned int miniBatchSize, float trainingRate) override;
 
+	/**
+	 * Clears the momentum and the replay buffer
+	*/
+	void setOnlineConfig(const OnlineConfig& config);
+	inline const OnlineConfig& getOnlineConfig() const { return m_onlineConfig; }
+
+	/**
+	 * One update from a small batch of labeled samples as they arrive, without loaded data.
+	 * Images are raw pixels like test takes them, getInputSize() bytes each.
+	 * Momentum and the replay buffer carry over between calls. Returns the cost of the batch,
+	 * 0 without an update when count is 0 and nothing can be replayed.
+	*/
+	float partialFit(const byte* imageData, const byte* labelData, unsigned int count);
+
+	/**
+	 * Safe to call from several threads as long as no training runs concurrently,
+	 * but allocates per call. Use exportModel and an InferenceContext per thread for serving.
+	*/
 	int test(byte* imageData) const override;
+
+	/**
+	 * Copies the current weights into an immutable model that stays valid after further training
+	*/
+	std::shared_ptr<const InferenceModel> exportModel() const;
 };
\ No newline at end of file
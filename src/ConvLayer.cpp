@@ -0,0 +1,606 @@
+#include "ConvLayer.h"
+
+#include <cstring>
+#include <vector>
+
+//Upper bound on im2col floats per block, keeps a block of columns in L2
+static const int IM2COL_BLOCK_FLOATS = 64 * 1024;
+
+ConvLayer::ConvLayer(const ConvLayerDesc& desc, const ConvShape& inputShape) :
+	m_weights(desc.numFilters, inputShape.channels * desc.kernelSize * desc.kernelSize), m_biases(desc.numFilters, 1), m_winogradKernels(1, 1),
+	m_inputShape(inputShape),
+	m_kernelSize(desc.kernelSize), m_stride(desc.stride), m_padding(desc.padding),
+	m_functionType(desc.functionType), m_poolingType(desc.poolingType), m_algorithm(desc.algorithm)
+{
+	m_convShape = ConvShape(desc.numFilters,
+		(inputShape.height + 2 * m_padding - m_kernelSize) / m_stride + 1,
+		(inputShape.width + 2 * m_padding - m_kernelSize) / m_stride + 1);
+
+	m_poolSize = (m_poolingType == POOL_NONE) ? 1 : desc.poolSize;
+	m_outputShape = ConvShape(desc.numFilters, m_convShape.height / m_poolSize, m_convShape.width / m_poolSize);
+
+	bool winogradShape = (m_kernelSize == 3 && m_stride == 1);
+	if(m_algorithm == CONV_AUTO || (m_algorithm == CONV_WINOGRAD && !winogradShape))
+	{
+		m_algorithm = winogradShape ? CONV_WINOGRAD : CONV_IM2COL;
+	}
+
+	if(m_algorithm == CONV_WINOGRAD)
+	{
+		m_winogradKernels = Matrix(desc.numFilters * inputShape.channels, 16);
+		transformKernels();
+	}
+}
+
+void ConvLayer::initWeightsAndBiases(float weightRangeStart, float weightRangeEnd, uint64_t seed)
+{
+	Philox generator(seed);
+	fillUniform(m_weights.getData(), m_weights.getRows() * m_weights.getColumns(), weightRangeStart, weightRangeEnd, generator, WEIGHT_STREAM);
+
+	m_biases.initValue(0);
+	transformKernels();
+}
+
+void ConvLayer::initWeights(WeightInit scheme, uint64_t seed)
+{
+	float range = weightInitRange(scheme, m_functionType, getFanIn(), getFanOut());
+	initWeightsAndBiases(-range, range, seed);
+}
+
+int ConvLayer::examplesPerBlock() const
+{
+	return std::max(1, IM2COL_BLOCK_FLOATS / (getFanIn() * m_convShape.height * m_convShape.width));
+}
+
+/**
+ * Unrolls the receptive fields of one image into a (channels * k * k, convHeight * convWidth)
+ * block of columns, rows are columnStride floats apart so several images can sit side by side
+*/
+void ConvLayer::im2col(const float* image, float* columns, int columnStride) const
+{
+	const int height = m_inputShape.height;
+	const int width = m_inputShape.width;
+
+	for(int c = 0; c < m_inputShape.channels; ++c)
+	{
+		for(int ky = 0; ky < m_kernelSize; ++ky)
+		{
+			for(int kx = 0; kx < m_kernelSize; ++kx)
+			{
+				float* row = columns + ((c * m_kernelSize + ky) * m_kernelSize + kx) * columnStride;
+
+				for(int oy = 0; oy < m_convShape.height; ++oy)
+				{
+					int iy = oy * m_stride - m_padding + ky;
+
+					for(int ox = 0; ox < m_convShape.width; ++ox)
+					{
+						int ix = ox * m_stride - m_padding + kx;
+						bool inside = iy >= 0 && iy < height && ix >= 0 && ix < width;
+
+						row[oy * m_convShape.width + ox] = inside ? image[(c * height + iy) * width + ix] : 0.0f;
+					}
+				}
+			}
+		}
+	}
+}
+
+void ConvLayer::col2im(const float* columns, int columnStride, float* image) const
+{
+	const int height = m_inputShape.height;
+	const int width = m_inputShape.width;
+
+	memset(image, 0, m_inputShape.size() * sizeof(float));
+
+	for(int c = 0; c < m_inputShape.channels; ++c)
+	{
+		for(int ky = 0; ky < m_kernelSize; ++ky)
+		{
+			for(int kx = 0; kx < m_kernelSize; ++kx)
+			{
+				const float* row = columns + ((c * m_kernelSize + ky) * m_kernelSize + kx) * columnStride;
+
+				for(int oy = 0; oy < m_convShape.height; ++oy)
+				{
+					int iy = oy * m_stride - m_padding + ky;
+					if(iy < 0 || iy >= height) continue;
+
+					for(int ox = 0; ox < m_convShape.width; ++ox)
+					{
+						int ix = ox * m_stride - m_padding + kx;
+						if(ix < 0 || ix >= width) continue;
+
+						image[(c * height + iy) * width + ix] += row[oy * m_convShape.width + ox];
+					}
+				}
+			}
+		}
+	}
+}
+
+void ConvLayer::convolveIm2col(const float* input, float* output, float* scratch) const
+{
+	const int numPositions = m_convShape.height * m_convShape.width;
+
+	im2col(input, scratch, numPositions);
+	Matrix::multiply(m_weights.getData(), scratch, output, m_convShape.channels, getFanIn(), numPositions);
+
+	for(int f = 0; f < m_convShape.channels; ++f)
+	{
+		float bias = m_biases.getValue(f, 0);
+		for(int p = 0; p < numPositions; ++p)
+		{
+			output[f * numPositions + p] += bias;
+		}
+	}
+}
+
+void ConvLayer::convolveDirect(const float* input, float* output) const
+{
+	const int height = m_inputShape.height;
+	const int width = m_inputShape.width;
+	const float* weights = m_weights.getData();
+
+	for(int f = 0; f < m_convShape.channels; ++f)
+	{
+		for(int oy = 0; oy < m_convShape.height; ++oy)
+		{
+			for(int ox = 0; ox < m_convShape.width; ++ox)
+			{
+				float value = m_biases.getValue(f, 0);
+
+				for(int c = 0; c < m_inputShape.channels; ++c)
+				{
+					const float* kernel = weights + (f * m_inputShape.channels + c) * m_kernelSize * m_kernelSize;
+
+					for(int ky = 0; ky < m_kernelSize; ++ky)
+					{
+						int iy = oy * m_stride - m_padding + ky;
+						if(iy < 0 || iy >= height) continue;
+
+						for(int kx = 0; kx < m_kernelSize; ++kx)
+						{
+							int ix = ox * m_stride - m_padding + kx;
+							if(ix < 0 || ix >= width) continue;
+
+							value += kernel[ky * m_kernelSize + kx] * input[(c * height + iy) * width + ix];
+						}
+					}
+				}
+
+				output[(f * m_convShape.height + oy) * m_convShape.width + ox] = value;
+			}
+		}
+	}
+}
+
+/**
+ * U = G g G^T for every filter and channel, written in place so concurrent readers never
+ * see a reallocated buffer
+*/
+void ConvLayer::transformKernels()
+{
+	if(m_algorithm != CONV_WINOGRAD)
+	{
+		return;
+	}
+
+	const float* weights = m_weights.getData();
+	float* transformedKernels = m_winogradKernels.getData();
+
+	for(int i = 0; i < m_convShape.channels * m_inputShape.channels; ++i)
+	{
+		const float* g = weights + i * 9;
+		float gg[4][3];
+		float* u = transformedKernels + i * 16;
+
+		for(int column = 0; column < 3; ++column)
+		{
+			float g0 = g[column], g1 = g[3 + column], g2 = g[6 + column];
+			gg[0][column] = g0;
+			gg[1][column] = 0.5f * (g0 + g1 + g2);
+			gg[2][column] = 0.5f * (g0 - g1 + g2);
+			gg[3][column] = g2;
+		}
+
+		for(int row = 0; row < 4; ++row)
+		{
+			float g0 = gg[row][0], g1 = gg[row][1], g2 = gg[row][2];
+			u[row * 4 + 0] = g0;
+			u[row * 4 + 1] = 0.5f * (g0 + g1 + g2);
+			u[row * 4 + 2] = 0.5f * (g0 - g1 + g2);
+			u[row * 4 + 3] = g2;
+		}
+	}
+}
+
+/**
+ * Winograd F(2x2, 3x3): each 2x2 output tile takes 16 multiplies per channel instead of 36.
+ * Y = A^T [sum over channels U . (B^T d B)] A, with U precomputed by transformKernels
+*/
+void ConvLayer::convolveWinograd(const float* input, float* output, float* scratch) const
+{
+	const int channels = m_inputShape.channels;
+	const int numFilters = m_convShape.channels;
+	const int height = m_inputShape.height;
+	const int width = m_inputShape.width;
+
+	const float* transformedKernels = m_winogradKernels.getData();	//(numFilters, channels, 16)
+	float* transformedTiles = scratch;								//(channels, 16)
+
+	int tilesY = (m_convShape.height + 1) / 2;
+	int tilesX = (m_convShape.width + 1) / 2;
+
+	for(int ty = 0; ty < tilesY; ++ty)
+	{
+		for(int tx = 0; tx < tilesX; ++tx)
+		{
+			int originY = ty * 2 - m_padding;
+			int originX = tx * 2 - m_padding;
+
+			//V = B^T d B
+			for(int c = 0; c < channels; ++c)
+			{
+				float d[4][4];
+				for(int y = 0; y < 4; ++y)
+				{
+					for(int x = 0; x < 4; ++x)
+					{
+						int iy = originY + y;
+						int ix = originX + x;
+						bool inside = iy >= 0 && iy < height && ix >= 0 && ix < width;
+
+						d[y][x] = inside ? input[(c * height + iy) * width + ix] : 0.0f;
+					}
+				}
+
+				float t[4][4];
+				for(int x = 0; x < 4; ++x)
+				{
+					t[0][x] = d[0][x] - d[2][x];
+					t[1][x] = d[1][x] + d[2][x];
+					t[2][x] = d[2][x] - d[1][x];
+					t[3][x] = d[1][x] - d[3][x];
+				}
+
+				float* v = transformedTiles + c * 16;
+				for(int y = 0; y < 4; ++y)
+				{
+					v[y * 4 + 0] = t[y][0] - t[y][2];
+					v[y * 4 + 1] = t[y][1] + t[y][2];
+					v[y * 4 + 2] = t[y][2] - t[y][1];
+					v[y * 4 + 3] = t[y][1] - t[y][3];
+				}
+			}
+
+			for(int f = 0; f < numFilters; ++f)
+			{
+				float m[16] = { 0 };
+				for(int c = 0; c < channels; ++c)
+				{
+					const float* u = transformedKernels + (f * channels + c) * 16;
+					const float* v = transformedTiles + c * 16;
+
+					for(int i = 0; i < 16; ++i)
+					{
+						m[i] += u[i] * v[i];
+					}
+				}
+
+				//Y = A^T m A
+				float s[2][4];
+				for(int x = 0; x < 4; ++x)
+				{
+					s[0][x] = m[x] + m[4 + x] + m[8 + x];
+					s[1][x] = m[4 + x] - m[8 + x] - m[12 + x];
+				}
+
+				float bias = m_biases.getValue(f, 0);
+				for(int y = 0; y < 2; ++y)
+				{
+					int oy = ty * 2 + y;
+					if(oy >= m_convShape.height) continue;
+
+					float values[2] = { s[y][0] + s[y][1] + s[y][2], s[y][1] - s[y][2] - s[y][3] };
+					for(int x = 0; x < 2; ++x)
+					{
+						int ox = tx * 2 + x;
+						if(ox >= m_convShape.width) continue;
+
+						output[(f * m_convShape.height + oy) * m_convShape.width + ox] = values[x] + bias;
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Values are (rows, numColumns) row-major, like a Matrix with one example per column
+*/
+static void poolColumns(PoolingType poolingType, int poolSize, const ConvShape& convShape, const ConvShape& outputShape,
+	const float* input, float* output, float* indices, int numColumns)
+{
+	const float scale = 1.0f / (poolSize * poolSize);
+
+	for(int f = 0; f < outputShape.channels; ++f)
+	{
+		for(int oy = 0; oy < outputShape.height; ++oy)
+		{
+			for(int ox = 0; ox < outputShape.width; ++ox)
+			{
+				int outputRow = (f * outputShape.height + oy) * outputShape.width + ox;
+
+				for(int j = 0; j < numColumns; ++j)
+				{
+					int bestRow = -1;
+					float value = 0.0f;
+
+					for(int py = 0; py < poolSize; ++py)
+					{
+						for(int px = 0; px < poolSize; ++px)
+						{
+							int inputRow = (f * convShape.height + oy * poolSize + py) * convShape.width + ox * poolSize + px;
+							float inputValue = input[inputRow * numColumns + j];
+
+							if(poolingType == POOL_AVERAGE)
+							{
+								value += inputValue * scale;
+							}
+							else if(bestRow < 0 || inputValue > value)
+							{
+								value = inputValue;
+								bestRow = inputRow;
+							}
+						}
+					}
+
+					output[outputRow * numColumns + j] = value;
+
+					if(indices)
+					{
+						indices[outputRow * numColumns + j] = (float)bestRow;
+					}
+				}
+			}
+		}
+	}
+}
+
+void ConvLayer::pool(const float* input, float* output, float* indices) const
+{
+	poolColumns(m_poolingType, m_poolSize, m_convShape, m_outputShape, input, output, indices, 1);
+}
+
+Matrix ConvLayer::calculateAcitvations(const Matrix& previousActivations, ConvCache* cache) const
+{
+	const int numExamples = previousActivations.getColumns();
+	const int numFilters = m_convShape.channels;
+	const int numPositions = m_convShape.height * m_convShape.width;
+	const int blockSize = examplesPerBlock();
+
+	Matrix weightedSums(numFilters * numPositions, numExamples);
+	std::vector<float> image(m_inputShape.size());
+
+	for(int first = 0; first < numExamples; first += blockSize)
+	{
+		int count = std::min(blockSize, numExamples - first);
+
+		Matrix columns(getFanIn(), count * numPositions);
+		for(int e = 0; e < count; ++e)
+		{
+			for(int i = 0; i < m_inputShape.size(); ++i)
+			{
+				image[i] = previousActivations.getValue(i, first + e);
+			}
+
+			im2col(image.data(), columns.getData() + e * numPositions, count * numPositions);
+		}
+
+		Matrix product = m_weights.dot(columns);
+
+		for(int f = 0; f < numFilters; ++f)
+		{
+			float bias = m_biases.getValue(f, 0);
+
+			for(int e = 0; e < count; ++e)
+			{
+				for(int p = 0; p < numPositions; ++p)
+				{
+					weightedSums.setValue(f * numPositions + p, first + e, product.getValue(f, e * numPositions + p) + bias);
+				}
+			}
+		}
+	}
+
+	Matrix activations(weightedSums.getRows(), numExamples);
+	applyActivation(m_functionType, weightedSums.getData(), activations.getData(), activations.getRows(), numExamples);
+
+	if(cache)
+	{
+		cache->weightedSums = weightedSums;
+	}
+
+	if(m_poolingType == POOL_NONE)
+	{
+		return activations;
+	}
+
+	Matrix pooled(m_outputShape.size(), numExamples);
+	float* indices = nullptr;
+
+	if(cache && m_poolingType == POOL_MAX)
+	{
+		cache->poolIndices = Matrix(m_outputShape.size(), numExamples);
+		indices = cache->poolIndices.getData();
+	}
+
+	poolColumns(m_poolingType, m_poolSize, m_convShape, m_outputShape, activations.getData(), pooled.getData(), indices, numExamples);
+
+	return pooled;
+}
+
+//activationDerivatives -> (outputSize, numExamples)
+Matrix ConvLayer::gradientDescent(const Matrix& activationDerivatives, const ConvCache& cache, const Matrix& previousLayerActivations, float learningRate)
+{
+	ConvGradients gradients;
+	Matrix dPrevious = computeGradients(activationDerivatives, cache, previousLayerActivations, gradients);
+
+	applyGradients(gradients, learningRate);
+
+	return dPrevious;
+}
+
+Matrix ConvLayer::computeGradients(const Matrix& activationDerivatives, const ConvCache& cache, const Matrix& previousLayerActivations, ConvGradients& gradients) const
+{
+	const int numExamples = activationDerivatives.getColumns();
+	const int numFilters = m_convShape.channels;
+	const int numPositions = m_convShape.height * m_convShape.width;
+	const int blockSize = examplesPerBlock();
+
+	//Route the derivatives back through the pooling step
+	Matrix dA = activationDerivatives;
+
+	if(m_poolingType != POOL_NONE)
+	{
+		dA = Matrix(numFilters * numPositions, numExamples).initValue(0);
+
+		for(int f = 0; f < numFilters; ++f)
+		{
+			for(int oy = 0; oy < m_outputShape.height; ++oy)
+			{
+				for(int ox = 0; ox < m_outputShape.width; ++ox)
+				{
+					int outputRow = (f * m_outputShape.height + oy) * m_outputShape.width + ox;
+
+					for(int j = 0; j < numExamples; ++j)
+					{
+						float derivative = activationDerivatives.getValue(outputRow, j);
+
+						if(m_poolingType == POOL_MAX)
+						{
+							int inputRow = (int)cache.poolIndices.getValue(outputRow, j);
+							dA.setValue(inputRow, j, dA.getValue(inputRow, j) + derivative);
+							continue;
+						}
+
+						for(int py = 0; py < m_poolSize; ++py)
+						{
+							for(int px = 0; px < m_poolSize; ++px)
+							{
+								int inputRow = (f * m_convShape.height + oy * m_poolSize + py) * m_convShape.width + ox * m_poolSize + px;
+								dA.setValue(inputRow, j, derivative / (m_poolSize * m_poolSize));
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	Matrix dZ(dA.getRows(), numExamples);
+	activationGradient(m_functionType, cache.weightedSums.getData(), dA.getData(), dZ.getData(), dZ.getRows(), numExamples);
+
+	Matrix dW = Matrix(m_weights.getRows(), m_weights.getColumns()).initValue(0);
+	Matrix dB = Matrix(numFilters, 1).initValue(0);
+	Matrix dPrevious(m_inputShape.size(), numExamples);
+
+	std::vector<float> image(m_inputShape.size());
+
+	for(int first = 0; first < numExamples; first += blockSize)
+	{
+		int count = std::min(blockSize, numExamples - first);
+
+		//Columns are rebuilt rather than cached, they are k * k times larger than the input
+		Matrix columns(getFanIn(), count * numPositions);
+		for(int e = 0; e < count; ++e)
+		{
+			for(int i = 0; i < m_inputShape.size(); ++i)
+			{
+				image[i] = previousLayerActivations.getValue(i, first + e);
+			}
+
+			im2col(image.data(), columns.getData() + e * numPositions, count * numPositions);
+		}
+
+		Matrix dZBlock(numFilters, count * numPositions);
+		for(int f = 0; f < numFilters; ++f)
+		{
+			for(int e = 0; e < count; ++e)
+			{
+				for(int p = 0; p < numPositions; ++p)
+				{
+					dZBlock.setValue(f, e * numPositions + p, dZ.getValue(f * numPositions + p, first + e));
+				}
+			}
+		}
+
+		dW = dW + dZBlock.dot(columns.transpose());
+		dB = dB + dZBlock.sumAcross(AXIS_HORIZONTAL);
+
+		Matrix dColumns = m_weights.transpose().dot(dZBlock);
+		for(int e = 0; e < count; ++e)
+		{
+			col2im(dColumns.getData() + e * numPositions, count * numPositions, image.data());
+
+			for(int i = 0; i < m_inputShape.size(); ++i)
+			{
+				dPrevious.setValue(i, first + e, image[i]);
+			}
+		}
+	}
+
+	float inverseNumExamples = (numExamples > 0) ? 1.0f / numExamples : 0.0f; //An empty batch has zero gradients
+	gradients.weights = inverseNumExamples * dW;
+	gradients.biases = inverseNumExamples * dB;
+
+	return dPrevious;
+}
+
+void ConvLayer::applyGradients(const ConvGradients& gradients, float learningRate)
+{
+	m_weights.addScaled(gradients.weights, -learningRate);
+	m_biases.addScaled(gradients.biases, -learningRate);
+	transformKernels();
+}
+
+void ConvLayer::forwardExample(const float* input, float* output, float* scratch) const
+{
+	const int convSize = m_convShape.size();
+
+	float* convOutput = output;
+	if(m_poolingType != POOL_NONE)
+	{
+		convOutput = scratch;
+		scratch += convSize;
+	}
+
+	switch(m_algorithm)
+	{
+	case CONV_DIRECT:	convolveDirect(input, convOutput); break;
+	case CONV_WINOGRAD:	convolveWinograd(input, convOutput, scratch); break;
+	default:			convolveIm2col(input, convOutput, scratch); break;
+	}
+
+	applyActivation(m_functionType, convOutput, convOutput, convSize, 1);
+
+	if(m_poolingType != POOL_NONE)
+	{
+		pool(convOutput, output, nullptr);
+	}
+}
+
+size_t ConvLayer::getScratchSize() const
+{
+	size_t size = (m_poolingType != POOL_NONE) ? m_convShape.size() : 0;
+
+	switch(m_algorithm)
+	{
+	case CONV_DIRECT:	break;
+	case CONV_WINOGRAD:	size += m_inputShape.channels * 16; break;
+	default:			size += getFanIn() * m_convShape.height * m_convShape.width; break;
+	}
+
+	return size;
+}
\ No newline at end of file
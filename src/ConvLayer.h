@@ -0,0 +1,209 @@
+#pragma once
+
+#include "Matrix.h"
+#include "Activations.h"
+#include "Random.h"
+#include "BFloat16.h"
+
+#include <algorithm>
+
+enum PoolingType
+{
+	POOL_NONE,
+	POOL_MAX,
+	POOL_AVERAGE
+};
+
+enum ConvAlgorithm
+{
+	CONV_AUTO,		//Winograd for 3x3 stride 1 kernels, im2col otherwise
+	CONV_IM2COL,
+	CONV_DIRECT,
+	CONV_WINOGRAD	//3x3 stride 1 only, F(2x2, 3x3)
+};
+
+struct ConvShape
+{
+	int channels;
+	int height;
+	int width;
+
+	ConvShape(int channels = 0, int height = 0, int width = 0) :
+		channels(channels), height(height), width(width)
+	{ }
+
+	inline int size() const { return channels * height * width; }
+};
+
+/**
+ * Convolution followed by an activation function and an optional pooling step.
+ * Inputs and outputs are flattened channel-major (channel, row, column) into the
+ * rows of a Matrix, one example per column like the dense layers.
+*/
+struct ConvLayerDesc
+{
+	int numFilters;
+	int kernelSize;
+	FunctionType functionType;
+	PoolingType poolingType;
+	int poolSize;
+	int stride;
+	int padding;
+	ConvAlgorithm algorithm; //Only affects inference, training always uses im2col
+
+	ConvLayerDesc(int numFilters, int kernelSize = 3, FunctionType functionType = FUNC_RELU, PoolingType poolingType = POOL_MAX, int poolSize = 2,
+		int stride = 1, int padding = -1, ConvAlgorithm algorithm = CONV_AUTO) :
+		numFilters(numFilters), kernelSize(kernelSize), functionType(functionType), poolingType(poolingType), poolSize(poolSize),
+		stride(stride), padding(padding < 0 ? kernelSize / 2 : padding), algorithm(algorithm)
+	{ }
+};
+
+/**
+ * Values of a training forward pass needed again by ConvLayer::gradientDescent
+*/
+struct ConvCache
+{
+	Matrix weightedSums;	//(numFilters * convHeight * convWidth, numExamples)
+	Matrix poolIndices;		//POOL_MAX only, index of the selected value within weightedSums' rows
+
+	//Mixed precision storage, pool indices stay fp32 since bf16 cannot hold them exactly
+	BF16Matrix packedWeightedSums;
+	bool packed = false;
+
+	ConvCache() :
+		weightedSums(1, 1), poolIndices(1, 1)
+	{ }
+
+	inline void pack()
+	{
+		packedWeightedSums = BF16Matrix(weightedSums);
+		weightedSums = Matrix(1, 1);
+		packed = true;
+	}
+
+	inline void unpack()
+	{
+		weightedSums = packedWeightedSums.toMatrix();
+		packedWeightedSums = BF16Matrix();
+		packed = false;
+	}
+};
+
+/**
+ * Parameter gradients of one minibatch, already averaged over its examples
+*/
+struct ConvGradients
+{
+	Matrix weights;
+	Matrix biases;
+
+	ConvGradients() :
+		weights(1, 1), biases(1, 1)
+	{ }
+};
+
+class ConvLayer
+{
+private:
+	Matrix m_weights; //(numFilters, channels * kernelSize * kernelSize)
+	Matrix m_biases;
+	Matrix m_winogradKernels; //CONV_WINOGRAD only, (numFilters * channels, 16) transforms G g G^T of m_weights
+
+	ConvShape m_inputShape;
+	ConvShape m_convShape;		//Before pooling
+	ConvShape m_outputShape;	//After pooling
+
+	int m_kernelSize = 0;
+	int m_stride = 1;
+	int m_padding = 0;
+	int m_poolSize = 1;
+
+	FunctionType m_functionType;
+	PoolingType m_poolingType;
+	ConvAlgorithm m_algorithm;
+private:
+	int examplesPerBlock() const;
+
+	void im2col(const float* image, float* columns, int columnStride) const;
+	void col2im(const float* columns, int columnStride, float* image) const;
+
+	void convolveIm2col(const float* input, float* output, float* scratch) const;
+	void convolveDirect(const float* input, float* output) const;
+	void convolveWinograd(const float* input, float* output, float* scratch) const;
+	void transformKernels();
+
+	void pool(const float* input, float* output, float* indices) const;
+public:
+	ConvLayer(const ConvLayerDesc& desc, const ConvShape& inputShape);
+
+	ConvLayer(const ConvLayer& other) :
+		m_weights(other.m_weights), m_biases(other.m_biases), m_winogradKernels(other.m_winogradKernels),
+		m_inputShape(other.m_inputShape), m_convShape(other.m_convShape), m_outputShape(other.m_outputShape),
+		m_kernelSize(other.m_kernelSize), m_stride(other.m_stride), m_padding(other.m_padding), m_poolSize(other.m_poolSize),
+		m_functionType(other.m_functionType), m_poolingType(other.m_poolingType), m_algorithm(other.m_algorithm)
+	{}
+
+	~ConvLayer() {}
+
+	/**
+	 * Deep copy, the copy constructor shares the weight buffers
+	*/
+	inline ConvLayer clone() const
+	{
+		ConvLayer layer(*this);
+		layer.m_weights = m_weights.copy();
+		layer.m_biases = m_biases.copy();
+		layer.m_winogradKernels = m_winogradKernels.copy();
+
+		return layer;
+	}
+
+	void initWeightsAndBiases(float weightRangeStart, float weightRangeEnd, uint64_t seed);
+	void initWeights(WeightInit scheme, uint64_t seed);
+
+	/**
+	 * Batched forward pass through im2col and Matrix::multiply, passing a cache stores
+	 * what gradientDescent needs
+	*/
+	Matrix calculateAcitvations(const Matrix& previousActivations, ConvCache* cache) const;
+	Matrix gradientDescent(const Matrix& activationDerivatives, const ConvCache& cache, const Matrix& previousLayerActivations, float learningRate);
+
+	/**
+	 * gradientDescent split in two for asynchronous training. Returns the derivatives
+	 * of the previous layer's activations.
+	*/
+	Matrix computeGradients(const Matrix& activationDerivatives, const ConvCache& cache, const Matrix& previousLayerActivations, ConvGradients& gradients) const;
+
+	/**
+	 * Updates the weights in place, so concurrent readers never see a reallocated buffer
+	*/
+	void applyGradients(const ConvGradients& gradients, float learningRate);
+
+	/**
+	 * Single example inference without allocations, using the configured algorithm.
+	 * scratch must hold getScratchSize() floats.
+	*/
+	void forwardExample(const float* input, float* output, float* scratch) const;
+	size_t getScratchSize() const;
+
+	/**
+	 * Refreshes the Winograd kernel transforms forwardExample uses, needed only after
+	 * writing the weights through getWeights()
+	*/
+	inline void weightsChanged()
+	{
+		transformKernels();
+	}
+
+	inline const ConvShape& getInputShape() const { return m_inputShape; }
+	inline const ConvShape& getOutputShape() const { return m_outputShape; }
+	inline int getFanIn() const { return m_inputShape.channels * m_kernelSize * m_kernelSize; }
+	inline int getFanOut() const { return m_convShape.channels * m_kernelSize * m_kernelSize; }
+	inline FunctionType getFunctionType() const { return m_functionType; }
+
+	inline Matrix& getWeights() { return m_weights; }
+	inline const Matrix& getWeights() const { return m_weights; }
+
+	inline Matrix& getBiases() { return m_biases; }
+	inline const Matrix& getBiases() const { return m_biases; }
+};
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include "InferenceModel.h"
+
+#include <math.h>
+
+const float InferenceModel::MAX_SPARSE_BLOCK_DENSITY = 0.6f;
+
+InferenceModel::InferenceModel(const std::vector<NetworkLayer>& layers) :
+	InferenceModel(std::vector<ConvLayer>(), layers)
+{ }
+
+InferenceModel::InferenceModel(const std::vector<ConvLayer>& convLayers, const std::vector<NetworkLayer>& layers)
+{
+	m_inputSize = layers.empty() ? 0 : layers[0].getLayerSize();
+
+	if(!convLayers.empty())
+	{
+		m_inputSize = convLayers[0].getInputShape().size();
+	}
+
+	m_maxLayerSize = m_inputSize;
+
+	for(const ConvLayer& layer : convLayers)
+	{
+		m_convLayers.push_back(layer.clone());
+
+		m_maxLayerSize = std::max(m_maxLayerSize, layer.getOutputShape().size());
+		m_convScratchSize = std::max(m_convScratchSize, layer.getScratchSize());
+	}
+
+	for(size_t i = 1; i < layers.size(); ++i)
+	{
+		//Batch normalization is folded into the weights and dropout is dropped
+		Matrix weights(1, 1);
+		Matrix biases(1, 1);
+		layers[i].foldedWeightsAndBiases(weights, biases);
+
+		DenseLayer layer;
+		layer.layerSize = layers[i].getLayerSize();
+		layer.previousLayerSize = weights.getColumns();
+		layer.functionType = layers[i].getFunctionType();
+
+		layer.weights.resize(weights.getRows() * weights.getColumns());
+		for(unsigned int row = 0; row < weights.getRows(); ++row)
+		{
+			for(unsigned int column = 0; column < weights.getColumns(); ++column)
+			{
+				layer.weights[row * weights.getColumns() + column] = weights.getValue(row, column);
+			}
+		}
+
+		//The sparse kernels need at least one full block width of columns
+		if(layer.previousLayerSize >= BlockSparseMatrix::BLOCK_COLUMNS &&
+			BlockSparseMatrix::blockDensity(layer.weights.data(), layer.layerSize, layer.previousLayerSize) <= MAX_SPARSE_BLOCK_DENSITY)
+		{
+			layer.sparseWeights = BlockSparseMatrix(layer.weights.data(), layer.layerSize, layer.previousLayerSize);
+			layer.sparse = true;
+
+			std::vector<float>().swap(layer.weights);
+		}
+
+		layer.biases.resize(biases.getRows());
+		for(unsigned int row = 0; row < biases.getRows(); ++row)
+		{
+			layer.biases[row] = biases.getValue(row, 0);
+		}
+
+		m_maxLayerSize = std::max(m_maxLayerSize, layer.layerSize);
+		m_layers.push_back(std::move(layer));
+	}
+}
+
+InferenceModel::InferenceModel(const InferenceModel& other) :
+	m_layers(other.m_layers), m_inputSize(other.m_inputSize), m_maxLayerSize(other.m_maxLayerSize), m_convScratchSize(other.m_convScratchSize)
+{
+	//ConvLayer copies share their weights, replicas need their own
+	for(const ConvLayer& layer : other.m_convLayers)
+	{
+		m_convLayers.push_back(layer.clone());
+	}
+}
+
+ReplicatedModel::ReplicatedModel(const std::shared_ptr<const InferenceModel>& model)
+{
+	const Topology& topology = Topology::get();
+	m_replicas.resize(topology.getNumNodes());
+
+	if(m_replicas.size() == 1)
+	{
+		m_replicas[0] = model;
+		return;
+	}
+
+	topology.runOnEachNode([&](size_t node) {
+		m_replicas[node] = model->replicate();
+	});
+}
+
+/**
+ * Returns whichever of the two scratch buffers holds the result
+*/
+const float* InferenceModel::forwardConvolutions(float* scratchA, float* scratchB, float* convScratch) const
+{
+	float* input = scratchA;
+	float* output = scratchB;
+
+	for(const ConvLayer& layer : m_convLayers)
+	{
+		layer.forwardExample(input, output, convScratch);
+		std::swap(input, output);
+	}
+
+	return input;
+}
+
+const float* InferenceModel::forward(float* scratchA, float* scratchB, float* convScratch) const
+{
+	float* input = (float*)forwardConvolutions(scratchA, scratchB, convScratch);
+	float* output = (input == scratchA) ? scratchB : scratchA;
+
+	for(const DenseLayer& layer : m_layers)
+	{
+		if(layer.sparse)
+		{
+			layer.sparseWeights.multiplyVector(input, layer.biases.data(), output);
+			applyActivation(layer.functionType, output, output, layer.layerSize, 1);
+
+			std::swap(input, output);
+			continue;
+		}
+
+		for(int i = 0; i < layer.layerSize; ++i)
+		{
+			const float* weightRow = &layer.weights[(size_t)i * layer.previousLayerSize];
+
+			float value = layer.biases[i];
+			for(int j = 0; j < layer.previousLayerSize; ++j)
+			{
+				value += weightRow[j] * input[j];
+			}
+
+			output[i] = value;
+		}
+
+		applyActivation(layer.functionType, output, output, layer.layerSize, 1);
+
+		std::swap(input, output);
+	}
+
+	return input;
+}
+
+const float* InferenceModel::forwardBatch(float* batchA, float* batchB, int count, float* scratchA, float* scratchB, float* convScratch) const
+{
+	float* input = batchA;
+	float* output = batchB;
+
+	if(!m_convLayers.empty())
+	{
+		int convOutputSize = m_convLayers.back().getOutputShape().size();
+
+		for(int e = 0; e < count; ++e)
+		{
+			for(int i = 0; i < m_inputSize; ++i)
+			{
+				scratchA[i] = input[(size_t)i * count + e];
+			}
+
+			const float* result = forwardConvolutions(scratchA, scratchB, convScratch);
+
+			for(int i = 0; i < convOutputSize; ++i)
+			{
+				output[(size_t)i * count + e] = result[i];
+			}
+		}
+
+		std::swap(input, output);
+	}
+
+	for(const DenseLayer& layer : m_layers)
+	{
+		if(layer.sparse)
+		{
+			layer.sparseWeights.multiply(input, layer.biases.data(), output, count);
+		}
+		else
+		{
+			Matrix::multiply(layer.weights.data(), input, output, layer.layerSize, layer.previousLayerSize, count);
+
+			for(int i = 0; i < layer.layerSize; ++i)
+			{
+				float* outRow = output + (size_t)i * count;
+				for(int e = 0; e < count; ++e)
+				{
+					outRow[e] += layer.biases[i];
+				}
+			}
+		}
+
+		applyActivation(layer.functionType, output, output, layer.layerSize, count);
+
+		std::swap(input, output);
+	}
+
+	return input;
+}
+
+size_t InferenceModel::getWeightBytes() const
+{
+	size_t size = 0;
+
+	for(const ConvLayer& layer : m_convLayers)
+	{
+		size += (layer.getWeights().getRows() * layer.getWeights().getColumns() + layer.getBiases().getRows()) * sizeof(float);
+	}
+
+	for(const DenseLayer& layer : m_layers)
+	{
+		size += layer.sparse ? layer.sparseWeights.getSizeInBytes() : layer.weights.size() * sizeof(float);
+		size += layer.biases.size() * sizeof(float);
+	}
+
+	return size;
+}
+
+int InferenceModel::getNumSparseLayers() const
+{
+	int count = 0;
+	for(const DenseLayer& layer : m_layers)
+	{
+		count += layer.sparse ? 1 : 0;
+	}
+
+	return count;
+}
+
+InferenceContext::InferenceContext(std::shared_ptr<const InferenceModel> model) :
+	m_model(model), m_scratchA(model->getMaxLayerSize()), m_scratchB(model->getMaxLayerSize()), m_convScratch(model->getConvScratchSize())
+{ }
+
+int InferenceContext::classify(const byte* imageData)
+{
+	for(int i = 0; i < m_model->getInputSize(); ++i)
+	{
+		m_scratchA[i] = normalizePixel(imageData[i]);
+	}
+
+	m_outputs = m_model->forward(m_scratchA.data(), m_scratchB.data(), m_convScratch.data());
+
+	int maxIndex = 0;
+	for(int i = 1; i < m_model->getOutputSize(); ++i)
+	{
+		if(m_outputs[i] > m_outputs[maxIndex])
+		{
+			maxIndex = i;
+		}
+	}
+
+	return maxIndex;
+}
+
+void InferenceContext::classifyBatch(const byte* imageData, int count, int* labels)
+{
+	const int inputSize = m_model->getInputSize();
+	const int outputSize = m_model->getOutputSize();
+	const size_t batchSize = (size_t)m_model->getMaxLayerSize() * count;
+
+	if(m_batchA.size() < batchSize)
+	{
+		m_batchA.resize(batchSize);
+		m_batchB.resize(batchSize);
+	}
+
+	for(int e = 0; e < count; ++e)
+	{
+		for(int i = 0; i < inputSize; ++i)
+		{
+			m_batchA[(size_t)i * count + e] = normalizePixel(imageData[(size_t)e * inputSize + i]);
+		}
+	}
+
+	const float* outputs = m_model->forwardBatch(m_batchA.data(), m_batchB.data(), count, m_scratchA.data(), m_scratchB.data(), m_convScratch.data());
+
+	for(int e = 0; e < count; ++e)
+	{
+		int maxIndex = 0;
+		for(int i = 1; i < outputSize; ++i)
+		{
+			if(outputs[(size_t)i * count + e] > outputs[(size_t)maxIndex * count + e])
+			{
+				maxIndex = i;
+			}
+		}
+
+		labels[e] = maxIndex;
+	}
+}
\ No newline at end of file
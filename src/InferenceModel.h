@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Common.h"
+#include "CPUNeuralNet.h"
+#include "Topology.h"
+#include "SparseMatrix.h"
+
+#include <vector>
+#include <memory>
+
+/**
+ * Immutable copy of a trained network's weights, meant to be shared through
+ * std::shared_ptr<const InferenceModel> between any number of threads.
+ * All evaluation state lives in an InferenceContext, so no locking is needed.
+*/
+class InferenceModel
+{
+private:
+	struct DenseLayer
+	{
+		int layerSize;
+		int previousLayerSize;
+		FunctionType functionType;
+
+		std::vector<float> weights; //Row-major (layerSize, previousLayerSize), empty for sparse layers
+		std::vector<float> biases;
+
+		BlockSparseMatrix sparseWeights;
+		bool sparse = false;
+	};
+
+	//Pruned layers with at most this fraction of nonzero blocks use the sparse kernels
+	static const float MAX_SPARSE_BLOCK_DENSITY;
+
+	std::vector<ConvLayer> m_convLayers;
+	std::vector<DenseLayer> m_layers;
+
+	int m_inputSize = 0;
+	int m_maxLayerSize = 0;
+	size_t m_convScratchSize = 0;
+private:
+	const float* forwardConvolutions(float* scratchA, float* scratchB, float* convScratch) const;
+public:
+	explicit InferenceModel(const std::vector<NetworkLayer>& layers);
+	InferenceModel(const std::vector<ConvLayer>& convLayers, const std::vector<NetworkLayer>& layers);
+
+	InferenceModel(const InferenceModel& other);
+
+	/**
+	 * Deep copy whose pages are first touched by the calling thread, call it from a
+	 * thread running on the NUMA node that will serve requests from the replica
+	*/
+	inline std::shared_ptr<const InferenceModel> replicate() const { return std::make_shared<InferenceModel>(*this); }
+
+	/**
+	 * Both scratch buffers must hold getMaxLayerSize() floats, input is read from scratchA.
+	 * convScratch must hold getConvScratchSize() floats.
+	 * Returns the buffer holding the output layer's activations.
+	*/
+	const float* forward(float* scratchA, float* scratchB, float* convScratch) const;
+
+	/**
+	 * Forward pass of count examples at once, through matrix-matrix products for the dense layers.
+	 * batchA and batchB must hold getMaxLayerSize() * count floats, input is read from batchA
+	 * with one example per column. scratchA, scratchB and convScratch are used as in forward
+	 * for the convolution layers, which still run one example at a time.
+	 * Returns the buffer holding the (getOutputSize(), count) output activations.
+	*/
+	const float* forwardBatch(float* batchA, float* batchB, int count, float* scratchA, float* scratchB, float* convScratch) const;
+
+	/**
+	 * Bytes of weights and biases as stored, to compare sparse and dense models
+	*/
+	size_t getWeightBytes() const;
+	int getNumSparseLayers() const;
+
+	inline int getInputSize() const { return m_inputSize; }
+	inline int getOutputSize() const { return m_layers.empty() ? m_inputSize : m_layers.back().layerSize; }
+	inline int getMaxLayerSize() const { return m_maxLayerSize; }
+	inline size_t getConvScratchSize() const { return m_convScratchSize; }
+};
+
+/**
+ * One replica of a model per NUMA node, each copied by a thread pinned to its node
+ * so the weights are read from local memory. Serving threads should stay on one node,
+ * for example by calling Topology::pinCurrentThread, and fetch getLocal() once.
+*/
+class ReplicatedModel
+{
+private:
+	std::vector<std::shared_ptr<const InferenceModel>> m_replicas;
+public:
+	explicit ReplicatedModel(const std::shared_ptr<const InferenceModel>& model);
+
+	inline size_t getNumReplicas() const { return m_replicas.size(); }
+	inline const std::shared_ptr<const InferenceModel>& getReplica(size_t node) const { return m_replicas[node]; }
+
+	/**
+	 * Replica of the node the calling thread is currently running on
+	*/
+	inline const std::shared_ptr<const InferenceModel>& getLocal() const { return m_replicas[Topology::get().getCurrentNode()]; }
+};
+
+/**
+ * Per-thread scratch buffers for evaluating an InferenceModel.
+ * A context must not be used by more than one thread at a time, create one per thread instead.
+*/
+class InferenceContext
+{
+private:
+	std::shared_ptr<const InferenceModel> m_model;
+
+	std::vector<float> m_scratchA;
+	std::vector<float> m_scratchB;
+	std::vector<float> m_convScratch;
+
+	//Grown on demand by classifyBatch
+	std::vector<float> m_batchA;
+	std::vector<float> m_batchB;
+
+	const float* m_outputs = nullptr;
+public:
+	explicit InferenceContext(std::shared_ptr<const InferenceModel> model);
+
+	int classify(const byte* imageData);
+
+	/**
+	 * Classifies count consecutive images, leaving getOutputs unchanged
+	*/
+	void classifyBatch(const byte* imageData, int count, int* labels);
+
+	inline const float* getOutputs() const { return m_outputs; }
+	inline const InferenceModel& getModel() const { return *m_model; }
+};
\ No newline at end of file
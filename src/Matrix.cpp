@@ -1,6 +1,7 @@
 #include "Matrix.h"
 
 #include <sstream>
+#include <cstdio>
 
 std::string Matrix::toString(int precision, const std::vector<std::string>& lineIndentations) const
 {
@@ -31,7 +32,7 @@ std::string Matrix::toString(int precision, const std::vector<std::string>& line
 
 		for (unsigned int j = 0; j < m_columns; ++j)
 		{
-			int length = sprintf_s(buffer, numberFormat.c_str(), getValue(i, j));
+			int length = snprintf(buffer, sizeof(buffer), numberFormat.c_str(), getValue(i, j));
 			lineLengths[j] = lineLengths[j] < length ? length : lineLengths[j];
 		}
 	}
@@ -60,7 +61,7 @@ std::string Matrix::toString(int precision, const std::vector<std::string>& line
 		int offset = 0;
 		for (unsigned int j = 0; j < m_columns; ++j)
 		{
-			int n = sprintf_s(spaces + offset, numSpaces - offset, numberFormat.c_str(), getValue(i, j));
+			int n = snprintf(spaces + offset, numSpaces - offset, numberFormat.c_str(), getValue(i, j));
 
 			spaces[offset + n] = ' ';
 			if (j < numAddSpaces)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <cstring>
 #include <functional>
 #include <cassert>
 #include <algorithm>
@@ -96,6 +97,23 @@ public:
 		return *this;
 	}
 
+	/**
+	 * this += scale * other in place, both matrices must have the same size.
+	 * Other matrices sharing the buffer see the change.
+	*/
+	inline Matrix& addScaled(const Matrix& other, float scale)
+	{
+		float* data = m_data.get();
+		const float* otherData = other.m_data.get();
+
+		for(unsigned int i = 0; i < m_rows * m_columns; ++i)
+		{
+			data[i] += scale * otherData[i];
+		}
+
+		return *this;
+	}
+
 	inline Matrix applyCopy(std::function<float(float)> modifier) const
 	{
 		return applyCopy([&](float value, int row, int column, int numRows, int numColumns) -> float {
@@ -126,21 +144,7 @@ public:
 		assert(m_columns == right.m_rows);
 
 		Matrix mat(m_rows, right.m_columns);
-
-		for(unsigned int i = 0; i < m_rows; ++i)
-		{
-			for(unsigned int j = 0; j < right.m_columns; ++j)
-			{
-				float value = 0;
-
-				for(unsigned int k = 0; k < m_columns; ++k)
-				{
-					value += getValue(i, k) * right.getValue(k, j);
-				}
-
-				mat.setValue(i, j, value);
-			}
-		}
+		multiply(m_data.get(), right.m_data.get(), mat.m_data.get(), m_rows, m_columns, right.m_columns);
 
 		return mat;
 	}
@@ -244,9 +248,40 @@ public:
 	inline void setValue(unsigned int row, unsigned int column, float value) { m_data.get()[row * m_columns + column] = value; }
 	inline float getValue(unsigned int row, unsigned int column) const { return m_data.get()[row * m_columns + column]; }
 
+	inline float* getData() { return m_data.get(); }
+	inline const float* getData() const { return m_data.get(); }
+
 	inline unsigned int getRows() const { return m_rows; }
 	inline unsigned int getColumns() const { return m_columns; }
 public:
+	/**
+	 * out(rows, columns) = left(rows, inner) * right(inner, columns), all row-major.
+	 * The inner loop runs along contiguous rows of right and out so it vectorizes.
+	*/
+	inline static void multiply(const float* left, const float* right, float* out, unsigned int rows, unsigned int inner, unsigned int columns)
+	{
+		for(unsigned int i = 0; i < rows; ++i)
+		{
+			float* outRow = out + i * columns;
+
+			for(unsigned int j = 0; j < columns; ++j)
+			{
+				outRow[j] = 0;
+			}
+
+			for(unsigned int k = 0; k < inner; ++k)
+			{
+				float leftValue = left[i * inner + k];
+				const float* rightRow = right + k * columns;
+
+				for(unsigned int j = 0; j < columns; ++j)
+				{
+					outRow[j] += leftValue * rightRow[j];
+				}
+			}
+		}
+	}
+
 	inline static Matrix sumAcross(const Matrix& matrix, MatrixAxis axis)
 	{
 		if(axis == AXIS_HORIZONTAL)
@@ -286,22 +321,22 @@ public:
 	}
 };
 
-inline Matrix operator+(float left, Matrix& mat)
+inline Matrix operator+(float left, const Matrix& mat)
 {
 	return mat.applyCopy([=](float value) -> float { return left + value; });
 }
 
-inline Matrix operator-(float left, Matrix& mat)
+inline Matrix operator-(float left, const Matrix& mat)
 {
 	return mat.applyCopy([=](float value) -> float { return left - value; });
 }
 
-inline Matrix operator*(float left, Matrix& mat)
+inline Matrix operator*(float left, const Matrix& mat)
 {
 	return mat.applyCopy([=](float value) -> float { return left * value; });
 }
 
-inline Matrix operator/(float left, Matrix& mat)
+inline Matrix operator/(float left, const Matrix& mat)
 {
 	return mat.applyCopy([=](float value) -> float { return left / value; });
 }
\ No newline at end of file
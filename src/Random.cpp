@@ -0,0 +1,71 @@
+#include "Random.h"
+
+#include <thread>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+//Below this many values the thread start-up costs more than the fill
+static const size_t PARALLEL_FILL_THRESHOLD = 1 << 16;
+
+static void fillUniformRange(float* data, size_t begin, size_t end, float low, float high, const Philox& generator, uint64_t stream)
+{
+	const float scale = high - low;
+	const size_t batchSize = 4 * Philox::BATCH_BLOCKS;
+
+	//begin is a multiple of 4, each Philox block yields four values
+	size_t i = begin;
+	for(; i + batchSize <= end; i += batchSize)
+	{
+		uint32_t values[4][Philox::BATCH_BLOCKS];
+		generator.generateBatch(stream, i / 4, values);
+
+		for(int b = 0; b < Philox::BATCH_BLOCKS; ++b)
+		{
+			for(int j = 0; j < 4; ++j)
+			{
+				data[i + b * 4 + j] = Philox::toUniform(values[j][b]) * scale + low;
+			}
+		}
+	}
+
+	for(; i < end; i += 4)
+	{
+		uint32_t values[4];
+		generator.generate(stream, i / 4, values);
+
+		size_t count = std::min((size_t)4, end - i);
+		for(size_t j = 0; j < count; ++j)
+		{
+			data[i + j] = Philox::toUniform(values[j]) * scale + low;
+		}
+	}
+}
+
+void fillUniform(float* data, size_t count, float low, float high, const Philox& generator, uint64_t stream, bool parallel)
+{
+	size_t numThreads = parallel ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+	numThreads = std::min(numThreads, count / PARALLEL_FILL_THRESHOLD + 1);
+
+	if(numThreads <= 1)
+	{
+		fillUniformRange(data, 0, count, low, high, generator, stream);
+		return;
+	}
+
+	size_t chunkSize = ((count + numThreads - 1) / numThreads + 3) & ~(size_t)3;
+
+	std::vector<std::thread> threads;
+	for(size_t begin = chunkSize; begin < count; begin += chunkSize)
+	{
+		size_t end = std::min(count, begin + chunkSize);
+		threads.emplace_back(fillUniformRange, data, begin, end, low, high, std::cref(generator), stream);
+	}
+
+	fillUniformRange(data, 0, std::min(count, chunkSize), low, high, generator, stream);
+
+	for(std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Philox4x32-10 counter-based generator. Each (key, counter) pair maps to four
+ * independent 32 bit values, so element i of a stream can be computed without
+ * generating the ones before it. Fills are therefore identical for any number of threads.
+*/
+class Philox
+{
+public:
+	static const int BATCH_BLOCKS = 16;
+private:
+	uint32_t m_key[2];
+private:
+	static inline void mulhilo(uint32_t a, uint32_t b, uint32_t& high, uint32_t& low)
+	{
+		uint64_t product = (uint64_t)a * b;
+		high = (uint32_t)(product >> 32);
+		low = (uint32_t)product;
+	}
+public:
+	explicit Philox(uint64_t seed)
+	{
+		m_key[0] = (uint32_t)seed;
+		m_key[1] = (uint32_t)(seed >> 32);
+	}
+
+	/**
+	 * Four random values for block 'counter' of stream 'stream'
+	*/
+	inline void generate(uint64_t stream, uint64_t counter, uint32_t out[4]) const
+	{
+		uint32_t c[4] = { (uint32_t)counter, (uint32_t)(counter >> 32), (uint32_t)stream, (uint32_t)(stream >> 32) };
+		uint32_t k0 = m_key[0];
+		uint32_t k1 = m_key[1];
+
+		for(int round = 0; round < 10; ++round)
+		{
+			uint32_t high0, low0, high1, low1;
+			mulhilo(0xD2511F53u, c[0], high0, low0);
+			mulhilo(0xCD9E8D57u, c[2], high1, low1);
+
+			c[0] = high1 ^ c[1] ^ k0;
+			c[1] = low1;
+			c[2] = high0 ^ c[3] ^ k1;
+			c[3] = low0;
+
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+
+		out[0] = c[0];
+		out[1] = c[1];
+		out[2] = c[2];
+		out[3] = c[3];
+	}
+
+	/**
+	 * generate for blocks firstCounter to firstCounter + BATCH_BLOCKS - 1, value i of block b
+	 * is out[i][b]. The rounds run across the blocks, so the compiler can keep them in vector registers.
+	*/
+	inline void generateBatch(uint64_t stream, uint64_t firstCounter, uint32_t out[4][BATCH_BLOCKS]) const
+	{
+		uint32_t* c0 = out[0];
+		uint32_t* c1 = out[1];
+		uint32_t* c2 = out[2];
+		uint32_t* c3 = out[3];
+
+		for(int b = 0; b < BATCH_BLOCKS; ++b)
+		{
+			uint64_t counter = firstCounter + b;
+			c0[b] = (uint32_t)counter;
+			c1[b] = (uint32_t)(counter >> 32);
+			c2[b] = (uint32_t)stream;
+			c3[b] = (uint32_t)(stream >> 32);
+		}
+
+		uint32_t k0 = m_key[0];
+		uint32_t k1 = m_key[1];
+
+		for(int round = 0; round < 10; ++round)
+		{
+			for(int b = 0; b < BATCH_BLOCKS; ++b)
+			{
+				uint64_t product0 = (uint64_t)0xD2511F53u * c0[b];
+				uint64_t product1 = (uint64_t)0xCD9E8D57u * c2[b];
+
+				uint32_t next0 = (uint32_t)(product1 >> 32) ^ c1[b] ^ k0;
+				uint32_t next2 = (uint32_t)(product0 >> 32) ^ c3[b] ^ k1;
+
+				c0[b] = next0;
+				c1[b] = (uint32_t)product1;
+				c2[b] = next2;
+				c3[b] = (uint32_t)product0;
+			}
+
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+	}
+
+	/**
+	 * Uniform value in [0, 1) for element 'index' of stream 'stream'
+	*/
+	inline float uniform(uint64_t stream, uint64_t index) const
+	{
+		uint32_t values[4];
+		generate(stream, index / 4, values);
+
+		return toUniform(values[index % 4]);
+	}
+
+	static inline float toUniform(uint32_t value)
+	{
+		return (float)(value >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+//Philox streams of a layer's seed, shared by the dense and convolution layers
+static const uint64_t WEIGHT_STREAM = 0;
+static const uint64_t BIAS_STREAM = 1;
+static const uint64_t FIRST_DROPOUT_STREAM = 2; //Plus the training step
+
+/**
+ * SplitMix64 finalizer, turns a seed and an index into an unrelated seed
+*/
+inline uint64_t deriveSeed(uint64_t seed, uint64_t index)
+{
+	uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+	return z ^ (z >> 31);
+}
+
+/**
+ * Fills data[i] with a uniform value in [low, high) taken from element i of the stream.
+ * Large fills are split across threads unless parallel is false, the result does not
+ * depend on the thread count. Fills repeated every minibatch, such as dropout masks,
+ * should stay serial since they may already run on a training worker.
+*/
+void fillUniform(float* data, size_t count, float low, float high, const Philox& generator, uint64_t stream, bool parallel = true);
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "SparseMatrix.h"
+
+#include <algorithm>
+
+//The AVX2 path is compiled with per-function target attributes and picked at run time,
+//so the default build needs no -mavx2 flags and still runs on any x86-64 CPU
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SPARSE_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+//Definitions for the class constants, std::min takes them by reference
+const int BlockSparseMatrix::BLOCK_ROWS;
+const int BlockSparseMatrix::BLOCK_COLUMNS;
+const int BlockSparseMatrix::BLOCK_SIZE;
+
+BlockSparseMatrix::BlockSparseMatrix(const float* weights, int rows, int columns) :
+	m_rows(rows), m_columns(columns)
+{
+	for(int blockRow = 0; blockRow < rows; blockRow += BLOCK_ROWS)
+	{
+		m_blockRowStarts.push_back((int)m_blockColumns.size());
+
+		for(int column = 0; column < columns; column += BLOCK_COLUMNS)
+		{
+			//Columns before 'column' belong to the previous block of a shifted last block
+			int start = std::min(column, columns - BLOCK_COLUMNS);
+
+			float block[BLOCK_SIZE] = {};
+			bool nonzero = false;
+
+			for(int i = 0; i < BLOCK_ROWS && blockRow + i < rows; ++i)
+			{
+				for(int k = column - start; k < BLOCK_COLUMNS; ++k)
+				{
+					float value = weights[(size_t)(blockRow + i) * columns + start + k];
+
+					block[i * BLOCK_COLUMNS + k] = value;
+					nonzero = nonzero || value != 0.0f;
+				}
+			}
+
+			if(nonzero)
+			{
+				m_blockColumns.push_back(start);
+				m_values.insert(m_values.end(), block, block + BLOCK_SIZE);
+			}
+		}
+	}
+
+	m_blockRowStarts.push_back((int)m_blockColumns.size());
+}
+
+float BlockSparseMatrix::blockDensity(const float* weights, int rows, int columns)
+{
+	int numBlocks = 0;
+	int numNonzero = 0;
+
+	for(int blockRow = 0; blockRow < rows; blockRow += BLOCK_ROWS)
+	{
+		for(int column = 0; column < columns; column += BLOCK_COLUMNS)
+		{
+			bool nonzero = false;
+
+			for(int i = blockRow; i < std::min(rows, blockRow + BLOCK_ROWS) && !nonzero; ++i)
+			{
+				for(int j = column; j < std::min(columns, column + BLOCK_COLUMNS); ++j)
+				{
+					nonzero = nonzero || weights[(size_t)i * columns + j] != 0.0f;
+				}
+			}
+
+			++numBlocks;
+			numNonzero += nonzero ? 1 : 0;
+		}
+	}
+
+	return numBlocks == 0 ? 0.0f : (float)numNonzero / numBlocks;
+}
+
+#ifdef SPARSE_X86_DISPATCH
+/**
+ * multiplyVector with every block row of 8 weights in one register, multiplied against the
+ * 8 inputs it covers with a single FMA
+*/
+__attribute__((target("avx2,fma")))
+static void multiplyVectorAVX2(const int* blockRowStarts, const int* blockColumns, const float* values, int rows,
+	const float* input, const float* biases, float* output)
+{
+	static_assert(BlockSparseMatrix::BLOCK_ROWS == 4 && BlockSparseMatrix::BLOCK_COLUMNS == 8, "One register per block row");
+
+	for(int blockRow = 0; blockRow * BlockSparseMatrix::BLOCK_ROWS < rows; ++blockRow)
+	{
+		__m256 sums[BlockSparseMatrix::BLOCK_ROWS];
+		for(int i = 0; i < BlockSparseMatrix::BLOCK_ROWS; ++i)
+		{
+			sums[i] = _mm256_setzero_ps();
+		}
+
+		for(int b = blockRowStarts[blockRow]; b < blockRowStarts[blockRow + 1]; ++b)
+		{
+			const float* block = values + (size_t)b * BlockSparseMatrix::BLOCK_SIZE;
+			__m256 x = _mm256_loadu_ps(input + blockColumns[b]);
+
+			for(int i = 0; i < BlockSparseMatrix::BLOCK_ROWS; ++i)
+			{
+				sums[i] = _mm256_fmadd_ps(_mm256_loadu_ps(block + i * BlockSparseMatrix::BLOCK_COLUMNS), x, sums[i]);
+			}
+		}
+
+		int firstRow = blockRow * BlockSparseMatrix::BLOCK_ROWS;
+		for(int i = 0; i < BlockSparseMatrix::BLOCK_ROWS && firstRow + i < rows; ++i)
+		{
+			__m128 half = _mm_add_ps(_mm256_castps256_ps128(sums[i]), _mm256_extractf128_ps(sums[i], 1));
+			half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+			half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+
+			output[firstRow + i] = biases[firstRow + i] + _mm_cvtss_f32(half);
+		}
+	}
+}
+
+static bool cpuSupportsAVX2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+bool BlockSparseMatrix::hasVectorKernels()
+{
+#ifdef SPARSE_X86_DISPATCH
+	static const bool supported = cpuSupportsAVX2();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+void BlockSparseMatrix::multiplyVector(const float* input, const float* biases, float* output) const
+{
+#ifdef SPARSE_X86_DISPATCH
+	if(hasVectorKernels())
+	{
+		multiplyVectorAVX2(m_blockRowStarts.data(), m_blockColumns.data(), m_values.data(), m_rows, input, biases, output);
+		return;
+	}
+#endif
+
+	for(int blockRow = 0; blockRow * BLOCK_ROWS < m_rows; ++blockRow)
+	{
+		float sums[BLOCK_ROWS][BLOCK_COLUMNS] = {};
+
+		//Lane-wise partial sums, reduced once per block row
+		for(int b = m_blockRowStarts[blockRow]; b < m_blockRowStarts[blockRow + 1]; ++b)
+		{
+			const float* values = &m_values[(size_t)b * BLOCK_SIZE];
+			const float* x = input + m_blockColumns[b];
+
+			for(int i = 0; i < BLOCK_ROWS; ++i)
+			{
+				for(int k = 0; k < BLOCK_COLUMNS; ++k)
+				{
+					sums[i][k] += values[i * BLOCK_COLUMNS + k] * x[k];
+				}
+			}
+		}
+
+		int firstRow = blockRow * BLOCK_ROWS;
+		for(int i = 0; i < BLOCK_ROWS && firstRow + i < m_rows; ++i)
+		{
+			float value = biases[firstRow + i];
+			for(int k = 0; k < BLOCK_COLUMNS; ++k)
+			{
+				value += sums[i][k];
+			}
+
+			output[firstRow + i] = value;
+		}
+	}
+}
+
+void BlockSparseMatrix::multiply(const float* input, const float* biases, float* output, int count) const
+{
+	for(int blockRow = 0; blockRow * BLOCK_ROWS < m_rows; ++blockRow)
+	{
+		int firstRow = blockRow * BLOCK_ROWS;
+		int numRows = std::min(BLOCK_ROWS, m_rows - firstRow);
+
+		for(int i = 0; i < numRows; ++i)
+		{
+			std::fill(output + (size_t)(firstRow + i) * count, output + (size_t)(firstRow + i + 1) * count, biases[firstRow + i]);
+		}
+
+		//Each weight scales a contiguous input row, so the inner loop runs along the examples
+		for(int b = m_blockRowStarts[blockRow]; b < m_blockRowStarts[blockRow + 1]; ++b)
+		{
+			const float* values = &m_values[(size_t)b * BLOCK_SIZE];
+
+			for(int i = 0; i < numRows; ++i)
+			{
+				float* outRow = output + (size_t)(firstRow + i) * count;
+
+				for(int k = 0; k < BLOCK_COLUMNS; ++k)
+				{
+					float weight = values[i * BLOCK_COLUMNS + k];
+					const float* inRow = input + (size_t)(m_blockColumns[b] + k) * count;
+
+					if(weight == 0.0f)
+					{
+						continue;
+					}
+
+					for(int n = 0; n < count; ++n)
+					{
+						outRow[n] += weight * inRow[n];
+					}
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Block compressed sparse row storage of a row-major weight matrix. A block covers
+ * BLOCK_ROWS rows and BLOCK_COLUMNS consecutive columns, so every block row fills one AVX
+ * register of floats, and only blocks holding a nonzero weight are stored.
+ * Block columns start at multiples of BLOCK_COLUMNS, except that a partial last block is
+ * shifted left to end on the last column so the kernels never read past the input.
+*/
+class BlockSparseMatrix
+{
+public:
+	static const int BLOCK_ROWS = 4;
+	static const int BLOCK_COLUMNS = 8;
+	static const int BLOCK_SIZE = BLOCK_ROWS * BLOCK_COLUMNS;
+private:
+	int m_rows = 0;
+	int m_columns = 0;
+
+	std::vector<int> m_blockRowStarts;	//First block of every block row, followed by the number of blocks
+	std::vector<int> m_blockColumns;	//First column of every block
+	std::vector<float> m_values;		//BLOCK_SIZE row-major values per block, zero outside the matrix
+public:
+	BlockSparseMatrix() {}
+
+	/**
+	 * columns must be at least BLOCK_COLUMNS
+	*/
+	BlockSparseMatrix(const float* weights, int rows, int columns);
+
+	/**
+	 * Fraction of the blocks that hold a nonzero weight, the share of the dense work
+	 * the sparse kernels still do
+	*/
+	static float blockDensity(const float* weights, int rows, int columns);
+
+	/**
+	 * True when multiplyVector runs its AVX2 kernel, picked at run time. Otherwise it runs
+	 * plain loops the compiler vectorizes for the baseline instruction set.
+	*/
+	static bool hasVectorKernels();
+
+	/**
+	 * output(rows) = weights * input(columns) + biases
+	*/
+	void multiplyVector(const float* input, const float* biases, float* output) const;
+
+	/**
+	 * output(rows, count) = weights * input(columns, count) + biases, row-major with one
+	 * example per column like Matrix
+	*/
+	void multiply(const float* input, const float* biases, float* output, int count) const;
+
+	inline int getRows() const { return m_rows; }
+	inline int getColumns() const { return m_columns; }
+	inline size_t getNumBlocks() const { return m_blockColumns.size(); }
+
+	inline size_t getSizeInBytes() const
+	{
+		return m_values.size() * sizeof(float) + (m_blockRowStarts.size() + m_blockColumns.size()) * sizeof(int);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "Topology.h"
+
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/**
+ * Parses a kernel cpu or node list such as "0-3,8-11"
+*/
+static std::vector<int> parseCpuList(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::stringstream stream(list);
+	std::string range;
+
+	while(std::getline(stream, range, ','))
+	{
+		size_t dash = range.find('-');
+		if(range.find_first_of("0123456789") == std::string::npos)
+		{
+			continue;
+		}
+
+		int first = std::stoi(range.substr(0, dash));
+		int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+
+		for(int cpu = first; cpu <= last; ++cpu)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+
+	return cpus;
+}
+
+Topology::Topology()
+{
+#ifdef __linux__
+	//Cores the process was started on, taskset or numactl --physcpubind may have narrowed them.
+	//Read before anything here pins a thread, so pinning never widens the operator's mask.
+	cpu_set_t allowed;
+	bool hasAllowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	auto isAllowed = [&](int cpu) -> bool {
+		return !hasAllowed || (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+	};
+
+	//Node numbers can have gaps, the kernel lists the ones that exist in the same format as cpus
+	std::ifstream onlineFile("/sys/devices/system/node/online");
+	std::string onlineList;
+	std::getline(onlineFile, onlineList);
+
+	for(int id : parseCpuList(onlineList))
+	{
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+		if(!file)
+		{
+			continue;
+		}
+
+		std::string list;
+		std::getline(file, list);
+
+		NumaNode node;
+		node.id = id;
+		node.cpus = parseCpuList(list);
+		node.cpus.erase(std::remove_if(node.cpus.begin(), node.cpus.end(), [&](int cpu) { return !isAllowed(cpu); }), node.cpus.end());
+
+		//Memory-only nodes and nodes outside the affinity mask have no cores to run workers on
+		if(!node.cpus.empty())
+		{
+			m_nodes.push_back(node);
+		}
+	}
+#endif
+
+	if(m_nodes.empty())
+	{
+		NumaNode node;
+		node.id = 0;
+
+#ifdef __linux__
+		for(int cpu = 0; hasAllowed && cpu < CPU_SETSIZE; ++cpu)
+		{
+			if(CPU_ISSET(cpu, &allowed))
+			{
+				node.cpus.push_back(cpu);
+			}
+		}
+#endif
+
+		for(unsigned int cpu = 0; node.cpus.empty() && cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+		{
+			node.cpus.push_back(cpu);
+		}
+
+		m_nodes.push_back(node);
+	}
+
+	for(size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		for(int cpu : m_nodes[i].cpus)
+		{
+			if(cpu >= (int)m_cpuNodes.size())
+			{
+				m_cpuNodes.resize(cpu + 1, -1);
+			}
+
+			m_cpuNodes[cpu] = (int)i;
+		}
+	}
+}
+
+const Topology& Topology::get()
+{
+	static const Topology topology;
+	return topology;
+}
+
+size_t Topology::getCurrentNode() const
+{
+#ifdef __linux__
+	int cpu = sched_getcpu();
+	if(cpu >= 0 && cpu < (int)m_cpuNodes.size() && m_cpuNodes[cpu] >= 0)
+	{
+		return m_cpuNodes[cpu];
+	}
+#endif
+
+	return 0;
+}
+
+bool Topology::pinCurrentThread(size_t node) const
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for(int cpu : m_nodes[node].cpus)
+	{
+		CPU_SET(cpu, &set);
+	}
+
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+void Topology::runOnEachNode(const std::function<void(size_t)>& task) const
+{
+	std::vector<std::thread> threads;
+
+	for(size_t node = 0; node < m_nodes.size(); ++node)
+	{
+		threads.push_back(std::thread([this, node, &task]() {
+			pinCurrentThread(node);
+			task(node);
+		}));
+	}
+
+	for(std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+struct NumaNode
+{
+	int id;					//Kernel node number
+	std::vector<int> cpus;
+};
+
+/**
+ * NUMA nodes and their cores, read once from /sys/devices/system/node on Linux and limited to
+ * the cores of the process' affinity mask at that time. Without sysfs every allowed core
+ * belongs to a single node.
+*/
+class Topology
+{
+private:
+	std::vector<NumaNode> m_nodes;
+	std::vector<int> m_cpuNodes; //Index into m_nodes for every cpu id, -1 for unknown cpus
+
+	Topology();
+public:
+	static const Topology& get();
+
+	inline size_t getNumNodes() const { return m_nodes.size(); }
+	inline const NumaNode& getNode(size_t index) const { return m_nodes[index]; }
+
+	/**
+	 * Node index of the core the calling thread is running on, 0 when unknown
+	*/
+	size_t getCurrentNode() const;
+
+	/**
+	 * Spreads consecutive workers round-robin over the nodes
+	*/
+	inline size_t getWorkerNode(unsigned int worker) const { return worker % m_nodes.size(); }
+
+	/**
+	 * Restricts the calling thread to the cores of a node, memory it touches first
+	 * afterwards is placed on that node. Returns false when pinning is unsupported.
+	*/
+	bool pinCurrentThread(size_t node) const;
+
+	/**
+	 * Runs task(node) once per node, each on a new thread pinned to that node, and waits for all of them
+	*/
+	void runOnEachNode(const std::function<void(size_t)>& task) const;
+};
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "Common.h"
 #include "NeuralNet.h"
 #include "CPUNeuralNet.h"
+#include "InferenceModel.h"
 
 #define _CRT_SECURE_NO_WARNINGS
 
@@ -125,6 +126,14 @@ int main()
 	{
 		neuralNet->loadImageData(&trainingSet.imageData[trainingSet.imageHeaderSize], trainingSet.columns, trainingSet.rows, trainingSet.numImages);
 		neuralNet->loadLabelData(&trainingSet.labelData[trainingSet.labelHeaderSize], trainingSet.numLabels);
+		ValidationConfig validationConfig;
+		validationConfig.validationFraction = 1.0f / 12.0f;
+		validationConfig.evaluationInterval = 5;
+		validationConfig.patience = 6;
+		validationConfig.schedule = SCHEDULE_PLATEAU;
+		validationConfig.plateauPatience = 2;
+		static_cast<CPUNeuralNet*>(neuralNet)->setValidationConfig(validationConfig);
+
 		neuralNet->train(400, 30, 0.0005f);
 
 		delete[] trainingSet.labelData;
@@ -136,12 +145,15 @@ int main()
 	DataSet testSet = loadDataSet(root + "t10k-images.idx3-ubyte", root + "t10k-labels.idx1-ubyte");
 	float accuracy = 0;
 
+	std::shared_ptr<const InferenceModel> model = static_cast<CPUNeuralNet*>(neuralNet)->exportModel();
+	InferenceContext inferenceContext(model);
+
 	int numTests = testSet.numImages;
 	for(int i = 0; i < numTests; ++i)
 	{
 		int size = testSet.rows * testSet.columns;
 		int y = (int)testSet.labelData[testSet.labelHeaderSize + i];
-		int a = neuralNet->test(&testSet.imageData[testSet.imageHeaderSize + i * size]);
+		int a = inferenceContext.classify(&testSet.imageData[testSet.imageHeaderSize + i * size]);
 
 		std::cout << "Testing image of " << y << ": " << a << std::endl;
 
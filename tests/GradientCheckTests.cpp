@@ -0,0 +1,250 @@
+#include "TestUtils.h"
+
+#include "CPUNeuralNet.h"
+#include "ConvLayer.h"
+
+#include <vector>
+#include <functional>
+
+//Central differences in fp32, large enough to stay clear of rounding noise in the loss
+static const float STEP = 1e-3f;
+static const double TOLERANCE = 1e-2;
+
+//One-sided differences further apart than this mean the step crossed a ReLU or max pool kink
+static const double KINK_THRESHOLD = 1e-2;
+static const double MAX_KINK_FRACTION = 0.1; //Of the values of one parameter, at least one is always allowed
+
+static const uint64_t DROPOUT_STEP = 3;
+
+/**
+ * Loss of the checks, sum(projection * activations). Its derivative with respect to the
+ * activations is the projection itself, so any activation function can be checked.
+*/
+static double projectedLoss(const Matrix& activations, const Matrix& projection)
+{
+	double loss = 0.0;
+
+	for(unsigned int i = 0; i < activations.getRows() * activations.getColumns(); ++i)
+	{
+		loss += (double)activations.getData()[i] * projection.getData()[i];
+	}
+
+	return loss;
+}
+
+/**
+ * Compares analytic * scale against central differences of loss over every value of parameter.
+ * Values whose step crosses a kink have no meaningful finite difference and are skipped,
+ * as long as they stay rare.
+*/
+static void checkGradient(TestSuite& suite, const std::string& name, Matrix& parameter, const Matrix& analytic, float scale, const std::function<double()>& loss)
+{
+	size_t count = parameter.getRows() * parameter.getColumns();
+	float* data = parameter.getData();
+
+	std::vector<float> numeric;
+	std::vector<float> expected;
+	size_t numKinks = 0;
+
+	double centerLoss = loss();
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		float original = data[i];
+
+		data[i] = original + STEP;
+		double lossPlus = loss();
+
+		data[i] = original - STEP;
+		double lossMinus = loss();
+
+		data[i] = original;
+
+		double forward = (lossPlus - centerLoss) / STEP;
+		double backward = (centerLoss - lossMinus) / STEP;
+		double central = (lossPlus - lossMinus) / (2.0 * STEP);
+
+		if(std::fabs(forward - backward) > KINK_THRESHOLD * std::max(1.0, std::fabs(central)))
+		{
+			++numKinks;
+			continue;
+		}
+
+		numeric.push_back((float)central);
+		expected.push_back(analytic.getData()[i] * scale);
+	}
+
+	std::string label = name;
+	if(numKinks > 0)
+	{
+		label += " (" + std::to_string(numKinks) + " kinks skipped)";
+		suite.check(name + " kink fraction", numKinks <= std::max(1.0, MAX_KINK_FRACTION * count));
+	}
+
+	suite.compare(label, numeric.data(), expected.data(), numeric.size(), TOLERANCE);
+}
+
+static void checkDenseLayer(TestSuite& suite, const std::string& name, const LayerDesc& desc, int previousLayerSize, int numExamples, uint32_t seed)
+{
+	std::mt19937 generator(seed);
+
+	NetworkLayer layer(desc, previousLayerSize);
+	layer.initWeights(INIT_AUTO, seed);
+	fillRandom(layer.getBiases().getData(), desc.layerSize, generator, -0.5f, 0.5f);
+
+	if(desc.batchNorm)
+	{
+		fillRandom(layer.getGamma().getData(), desc.layerSize, generator, 0.5f, 1.5f);
+		fillRandom(layer.getBeta().getData(), desc.layerSize, generator, -0.5f, 0.5f);
+	}
+
+	Matrix input(previousLayerSize, numExamples);
+	Matrix projection(desc.layerSize, numExamples);
+	fillRandom(input.getData(), previousLayerSize * numExamples, generator);
+	fillRandom(projection.getData(), desc.layerSize * numExamples, generator);
+
+	LayerCache cache;
+	cache.dropoutStep = DROPOUT_STEP;
+	layer.calculateAcitvations(input, &cache);
+
+	LayerGradients gradients;
+	Matrix inputGradients = layer.computeGradients(projection, cache, input, gradients);
+
+	auto loss = [&]() -> double {
+		LayerCache lossCache;
+		lossCache.dropoutStep = DROPOUT_STEP;
+
+		return projectedLoss(layer.calculateAcitvations(input, &lossCache), projection);
+	};
+
+	//Parameter gradients are averaged over the batch
+	checkGradient(suite, name + " weights", layer.getWeights(), gradients.weights, (float)numExamples, loss);
+	checkGradient(suite, name + " biases", layer.getBiases(), gradients.biases, (float)numExamples, loss);
+
+	if(desc.batchNorm)
+	{
+		checkGradient(suite, name + " gamma", layer.getGamma(), gradients.gamma, (float)numExamples, loss);
+		checkGradient(suite, name + " beta", layer.getBeta(), gradients.beta, (float)numExamples, loss);
+	}
+
+	checkGradient(suite, name + " input", input, inputGradients, 1.0f, loss);
+}
+
+/**
+ * Output layer gradients of the fused softmax cross-entropy path against central differences of
+ * the natural log loss, with the biases pushing the true class probability below 1e-7.
+ * The unfused path through -y / a and the softmax Jacobian vanishes there.
+*/
+static void checkSoftmaxCrossEntropy(TestSuite& suite, const std::string& name, int layerSize, float logitGap, int numExamples, uint32_t seed)
+{
+	const int previousLayerSize = 4;
+	std::mt19937 generator(seed);
+
+	LayerDesc desc(layerSize, FUNC_SOFTMAX);
+	NetworkLayer layer(desc, previousLayerSize);
+	layer.initWeights(INIT_AUTO, seed);
+
+	//Every example belongs to the last class, the first one gets the large logit
+	layer.getBiases().initValue(0);
+	layer.getBiases().setValue(0, 0, logitGap);
+
+	Matrix input(previousLayerSize, numExamples);
+	fillRandom(input.getData(), previousLayerSize * numExamples, generator);
+
+	Matrix groundTruth = Matrix(desc.layerSize, numExamples).initValue(0);
+	for(int j = 0; j < numExamples; ++j)
+	{
+		groundTruth.setValue(desc.layerSize - 1, j, 1.0f);
+	}
+
+	LayerCache cache;
+	Matrix activations = layer.calculateAcitvations(input, &cache);
+
+	suite.check(name + " fuses", layer.fusesCrossEntropy());
+	suite.check(name + " saturated", activations.getValue(desc.layerSize - 1, 0) < 1e-7f);
+
+	LayerGradients gradients;
+	Matrix inputGradients = layer.computeGradients(activations - groundTruth, cache, input, gradients, true);
+
+	auto loss = [&]() -> double {
+		LayerCache lossCache;
+		Matrix outputs = layer.calculateAcitvations(input, &lossCache);
+
+		double total = 0.0;
+		for(int j = 0; j < numExamples; ++j)
+		{
+			total -= std::log((double)outputs.getValue(desc.layerSize - 1, j));
+		}
+
+		return total;
+	};
+
+	checkGradient(suite, name + " weights", layer.getWeights(), gradients.weights, (float)numExamples, loss);
+	checkGradient(suite, name + " biases", layer.getBiases(), gradients.biases, (float)numExamples, loss);
+	checkGradient(suite, name + " input", input, inputGradients, 1.0f, loss);
+}
+
+static void checkConvLayer(TestSuite& suite, const std::string& name, const ConvLayerDesc& desc, const ConvShape& inputShape, int numExamples, uint32_t seed)
+{
+	std::mt19937 generator(seed);
+
+	ConvLayer layer(desc, inputShape);
+	layer.initWeights(INIT_AUTO, seed);
+	fillRandom(layer.getBiases().getData(), desc.numFilters, generator, -0.5f, 0.5f);
+
+	int outputSize = layer.getOutputShape().size();
+
+	Matrix input(inputShape.size(), numExamples);
+	Matrix projection(outputSize, numExamples);
+	fillRandom(input.getData(), inputShape.size() * numExamples, generator);
+	fillRandom(projection.getData(), outputSize * numExamples, generator);
+
+	ConvCache cache;
+	layer.calculateAcitvations(input, &cache);
+
+	ConvGradients gradients;
+	Matrix inputGradients = layer.computeGradients(projection, cache, input, gradients);
+
+	auto loss = [&]() -> double {
+		ConvCache lossCache;
+		return projectedLoss(layer.calculateAcitvations(input, &lossCache), projection);
+	};
+
+	checkGradient(suite, name + " weights", layer.getWeights(), gradients.weights, (float)numExamples, loss);
+	checkGradient(suite, name + " biases", layer.getBiases(), gradients.biases, (float)numExamples, loss);
+	checkGradient(suite, name + " input", input, inputGradients, 1.0f, loss);
+}
+
+int main()
+{
+	TestSuite suite;
+
+	const char* functionNames[] = { "relu", "sigmoid", "leaky relu", "tanh", "gelu", "softmax" };
+	const FunctionType functionTypes[] = { FUNC_RELU, FUNC_SIGMOID, FUNC_LEAKY_RELU, FUNC_TANH, FUNC_GELU, FUNC_SOFTMAX };
+
+	for(int i = 0; i < 6; ++i)
+	{
+		std::string name = std::string("dense ") + functionNames[i];
+		uint32_t seed = 100 + i;
+
+		checkDenseLayer(suite, name, LayerDesc(7, functionTypes[i]), 5, 6, seed);
+		checkDenseLayer(suite, name + " bn", LayerDesc(7, functionTypes[i], 0.0f, true), 5, 6, seed);
+		checkDenseLayer(suite, name + " dropout", LayerDesc(7, functionTypes[i], 0.3f), 5, 6, seed);
+		checkDenseLayer(suite, name + " bn dropout", LayerDesc(7, functionTypes[i], 0.3f, true), 5, 6, seed);
+	}
+
+	checkDenseLayer(suite, "dense single input", LayerDesc(3, FUNC_TANH), 1, 4, 200);
+	checkDenseLayer(suite, "dense single example", LayerDesc(9, FUNC_SIGMOID), 11, 1, 201);
+
+	checkSoftmaxCrossEntropy(suite, "softmax cross-entropy gap 20", 3, 20.0f, 4, 400);
+	checkSoftmaxCrossEntropy(suite, "softmax cross-entropy gap 30", 3, 30.0f, 4, 401);
+	checkSoftmaxCrossEntropy(suite, "softmax cross-entropy gap 60", 5, 60.0f, 3, 402);
+
+	checkConvLayer(suite, "conv relu max pool", ConvLayerDesc(3, 3, FUNC_RELU, POOL_MAX, 2), ConvShape(1, 6, 6), 3, 300);
+	checkConvLayer(suite, "conv sigmoid average pool k5", ConvLayerDesc(2, 5, FUNC_SIGMOID, POOL_AVERAGE, 2), ConvShape(3, 8, 8), 2, 301);
+	checkConvLayer(suite, "conv tanh stride 2 odd shape", ConvLayerDesc(4, 3, FUNC_TANH, POOL_NONE, 1, 2), ConvShape(2, 7, 5), 3, 302);
+	checkConvLayer(suite, "conv leaky relu 1x1", ConvLayerDesc(3, 1, FUNC_LEAKY_RELU, POOL_NONE), ConvShape(2, 5, 6), 2, 303);
+	checkConvLayer(suite, "conv gelu unpadded max pool 3", ConvLayerDesc(2, 3, FUNC_GELU, POOL_MAX, 3, 1, 0), ConvShape(2, 9, 9), 2, 304);
+
+	return suite.finish();
+}
\ No newline at end of file
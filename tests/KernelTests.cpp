@@ -0,0 +1,678 @@
+#include "TestUtils.h"
+
+#include "Matrix.h"
+#include "BFloat16.h"
+#include "ConvLayer.h"
+#include "SparseMatrix.h"
+#include "InferenceModel.h"
+
+#include <vector>
+#include <limits>
+#include <cstring>
+
+static const int NUM_RANDOM_SHAPES = 40;
+
+static Matrix randomMatrix(unsigned int rows, unsigned int columns, std::mt19937& generator)
+{
+	Matrix matrix(rows, columns);
+	fillRandom(matrix.getData(), rows * columns, generator);
+
+	return matrix;
+}
+
+static std::string shapeName(const std::string& name, unsigned int rows, unsigned int columns)
+{
+	return name + " " + std::to_string(rows) + "x" + std::to_string(columns);
+}
+
+static void referenceMultiply(const float* left, const float* right, float* out, unsigned int rows, unsigned int inner, unsigned int columns)
+{
+	for(unsigned int i = 0; i < rows; ++i)
+	{
+		for(unsigned int j = 0; j < columns; ++j)
+		{
+			double sum = 0.0;
+			for(unsigned int k = 0; k < inner; ++k)
+			{
+				sum += (double)left[i * inner + k] * right[k * columns + j];
+			}
+
+			out[i * columns + j] = (float)sum;
+		}
+	}
+}
+
+static void testDot(TestSuite& suite, std::mt19937& generator)
+{
+	for(int test = 0; test < NUM_RANDOM_SHAPES; ++test)
+	{
+		//Mostly odd sizes, with a few large enough to leave any blocking remainder
+		unsigned int rows = randomInt(generator, 1, test < 35 ? 17 : 131);
+		unsigned int inner = randomInt(generator, 1, test < 35 ? 17 : 257);
+		unsigned int columns = randomInt(generator, 1, test < 35 ? 17 : 67);
+
+		Matrix left = randomMatrix(rows, inner, generator);
+		Matrix right = randomMatrix(inner, columns, generator);
+
+		Matrix product = left.dot(right);
+		std::vector<float> expected(rows * columns);
+		referenceMultiply(left.getData(), right.getData(), expected.data(), rows, inner, columns);
+
+		suite.compare(shapeName("dot", rows, inner) + "x" + std::to_string(columns), expected.data(), product.getData(), rows * columns, 1e-5);
+	}
+}
+
+static void testUnalignedMultiply(TestSuite& suite, std::mt19937& generator)
+{
+	for(int offset = 1; offset < 4; ++offset)
+	{
+		unsigned int rows = randomInt(generator, 1, 23);
+		unsigned int inner = randomInt(generator, 1, 37);
+		unsigned int columns = randomInt(generator, 1, 29);
+
+		//Operands start 'offset' floats into their buffers, off any vector alignment
+		std::vector<float> left(rows * inner + offset);
+		std::vector<float> right(inner * columns + offset);
+		std::vector<float> out(rows * columns + offset);
+		std::vector<float> expected(rows * columns);
+
+		fillRandom(left.data() + offset, rows * inner, generator);
+		fillRandom(right.data() + offset, inner * columns, generator);
+
+		Matrix::multiply(left.data() + offset, right.data() + offset, out.data() + offset, rows, inner, columns);
+		referenceMultiply(left.data() + offset, right.data() + offset, expected.data(), rows, inner, columns);
+
+		suite.compare("multiply offset " + std::to_string(offset), expected.data(), out.data() + offset, rows * columns, 1e-5);
+	}
+}
+
+static void testTranspose(TestSuite& suite, std::mt19937& generator)
+{
+	for(int test = 0; test < 8; ++test)
+	{
+		unsigned int rows = randomInt(generator, 1, 41);
+		unsigned int columns = randomInt(generator, 1, 41);
+
+		Matrix matrix = randomMatrix(rows, columns, generator);
+		Matrix transposed = matrix.transpose();
+
+		std::vector<float> expected(rows * columns);
+		for(unsigned int i = 0; i < rows; ++i)
+		{
+			for(unsigned int j = 0; j < columns; ++j)
+			{
+				expected[j * rows + i] = matrix.getValue(i, j);
+			}
+		}
+
+		bool shapeMatches = transposed.getRows() == columns && transposed.getColumns() == rows;
+		suite.check(shapeName("transpose shape", rows, columns), shapeMatches);
+
+		if(shapeMatches)
+		{
+			suite.compare(shapeName("transpose", rows, columns), expected.data(), transposed.getData(), rows * columns, 0.0);
+		}
+	}
+}
+
+/**
+ * Element-wise operators broadcast a row, a column or a single value across the other operand
+*/
+static void testBroadcast(TestSuite& suite, std::mt19937& generator)
+{
+	const char* operatorNames[] = { "+", "-", "*", "/" };
+
+	for(int test = 0; test < 6; ++test)
+	{
+		unsigned int rows = randomInt(generator, 2, 19);
+		unsigned int columns = randomInt(generator, 2, 19);
+
+		unsigned int shapes[4][2] = { { rows, columns }, { rows, 1 }, { 1, columns }, { 1, 1 } };
+
+		for(int shape = 0; shape < 4; ++shape)
+		{
+			for(int swap = 0; swap < 2; ++swap)
+			{
+				Matrix left = swap ? randomMatrix(shapes[shape][0], shapes[shape][1], generator) : randomMatrix(rows, columns, generator);
+				Matrix right = swap ? randomMatrix(rows, columns, generator) : randomMatrix(shapes[shape][0], shapes[shape][1], generator);
+
+				//Keep divisors away from zero
+				right.apply([](float value) -> float { return value < 0 ? value - 0.5f : value + 0.5f; });
+
+				for(int op = 0; op < 4; ++op)
+				{
+					Matrix result = (op == 0) ? left + right : (op == 1) ? left - right : (op == 2) ? left * right : left / right;
+
+					std::vector<float> expected(rows * columns);
+					for(unsigned int i = 0; i < rows; ++i)
+					{
+						for(unsigned int j = 0; j < columns; ++j)
+						{
+							float a = left.getValue(i % left.getRows(), j % left.getColumns());
+							float b = right.getValue(i % right.getRows(), j % right.getColumns());
+
+							expected[i * columns + j] = (op == 0) ? a + b : (op == 1) ? a - b : (op == 2) ? a * b : a / b;
+						}
+					}
+
+					std::string name = shapeName("broadcast", left.getRows(), left.getColumns()) + " " + operatorNames[op] + " "
+						+ std::to_string(right.getRows()) + "x" + std::to_string(right.getColumns());
+
+					if(suite.check(name + " shape", result.getRows() == rows && result.getColumns() == columns))
+					{
+						suite.compare(name, expected.data(), result.getData(), rows * columns, 1e-6);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void testScalarOperators(TestSuite& suite, std::mt19937& generator)
+{
+	unsigned int rows = randomInt(generator, 1, 23);
+	unsigned int columns = randomInt(generator, 1, 23);
+
+	Matrix matrix = randomMatrix(rows, columns, generator);
+	matrix.apply([](float value) -> float { return value < 0 ? value - 0.5f : value + 0.5f; });
+
+	const float scalar = 1.75f;
+	const char* names[] = { "m + s", "m - s", "m * s", "m / s", "s + m", "s - m", "s * m", "s / m", "-m" };
+
+	Matrix results[] = { matrix + scalar, matrix - scalar, matrix * scalar, matrix / scalar,
+		scalar + matrix, scalar - matrix, scalar * matrix, scalar / matrix, -matrix };
+
+	for(int op = 0; op < 9; ++op)
+	{
+		std::vector<float> expected(rows * columns);
+		for(unsigned int i = 0; i < rows * columns; ++i)
+		{
+			float value = matrix.getData()[i];
+			float values[] = { value + scalar, value - scalar, value * scalar, value / scalar,
+				scalar + value, scalar - value, scalar * value, scalar / value, -value };
+
+			expected[i] = values[op];
+		}
+
+		suite.compare(std::string("scalar ") + names[op], expected.data(), results[op].getData(), rows * columns, 1e-6);
+	}
+}
+
+static void testReductions(TestSuite& suite, std::mt19937& generator)
+{
+	for(int test = 0; test < 8; ++test)
+	{
+		unsigned int rows = randomInt(generator, 1, test < 6 ? 23 : 301);
+		unsigned int columns = randomInt(generator, 1, test < 6 ? 23 : 301);
+
+		Matrix matrix = randomMatrix(rows, columns, generator);
+
+		std::vector<float> rowSums(rows);
+		std::vector<float> columnSums(columns);
+
+		for(unsigned int i = 0; i < rows; ++i)
+		{
+			double sum = 0.0;
+			for(unsigned int j = 0; j < columns; ++j)
+			{
+				sum += matrix.getValue(i, j);
+			}
+
+			rowSums[i] = (float)sum;
+		}
+
+		for(unsigned int j = 0; j < columns; ++j)
+		{
+			double sum = 0.0;
+			for(unsigned int i = 0; i < rows; ++i)
+			{
+				sum += matrix.getValue(i, j);
+			}
+
+			columnSums[j] = (float)sum;
+		}
+
+		Matrix horizontal = matrix.sumAcross(AXIS_HORIZONTAL);
+		Matrix vertical = Matrix::sumAcross(matrix, AXIS_VERTICAL);
+
+		suite.compare(shapeName("sumAcross horizontal", rows, columns), rowSums.data(), horizontal.getData(), rows, 1e-5);
+		suite.compare(shapeName("sumAcross vertical", rows, columns), columnSums.data(), vertical.getData(), columns, 1e-5);
+	}
+}
+
+static void testAddScaled(TestSuite& suite, std::mt19937& generator)
+{
+	unsigned int rows = randomInt(generator, 1, 37);
+	unsigned int columns = randomInt(generator, 1, 37);
+
+	Matrix matrix = randomMatrix(rows, columns, generator);
+	Matrix other = randomMatrix(rows, columns, generator);
+
+	std::vector<float> expected(rows * columns);
+	for(unsigned int i = 0; i < rows * columns; ++i)
+	{
+		expected[i] = matrix.getData()[i] + (-0.3f) * other.getData()[i];
+	}
+
+	matrix.addScaled(other, -0.3f);
+	suite.compare(shapeName("addScaled", rows, columns), expected.data(), matrix.getData(), rows * columns, 1e-6);
+}
+
+/**
+ * Batched Philox fills against single values of the stream, across the batch boundary and tail
+*/
+static void testFillUniform(TestSuite& suite, std::mt19937& generator)
+{
+	Philox philox(0x123456789ull);
+
+	for(size_t count = 1; count < 300; count += randomInt(generator, 1, 23))
+	{
+		uint64_t stream = randomInt(generator, 0, 1000);
+
+		std::vector<float> actual(count);
+		fillUniform(actual.data(), count, -2.0f, 3.0f, philox, stream, false);
+
+		std::vector<float> expected(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			expected[i] = philox.uniform(stream, i) * 5.0f - 2.0f;
+		}
+
+		suite.compare("fillUniform count " + std::to_string(count), expected.data(), actual.data(), count, 0.0);
+	}
+}
+
+/**
+ * The vectorized conversions against the scalar reference, including the values
+ * where rounding or NaN handling differs. Without AVX512-BF16 this checks the scalar tail only.
+*/
+static void testBFloat16(TestSuite& suite, std::mt19937& generator)
+{
+	const std::string path = hasNativeBF16Conversion() ? " avx512" : " scalar";
+
+	const float specials[] = { 0.0f, -0.0f, 1.0f, -1.0f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+		std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::denorm_min(), std::numeric_limits<float>::max(),
+		1.00390625f /*tie, rounds to even*/, 1.01171875f /*tie, rounds up*/, 3.3895314e38f /*rounds to infinity*/ };
+	const size_t numSpecials = sizeof(specials) / sizeof(specials[0]);
+
+	for(size_t count = 0; count < 70; count += randomInt(generator, 1, 9))
+	{
+		size_t offset = count % 4;
+
+		std::vector<float> input(count + offset);
+		fillRandom(input.data() + offset, count, generator, -1000.0f, 1000.0f);
+
+		for(size_t i = 0; i < count; i += 3)
+		{
+			input[offset + i] = specials[(i / 3) % numSpecials];
+		}
+
+		std::vector<bfloat16> packed(count + offset);
+		convertToBF16(input.data() + offset, packed.data() + offset, count);
+
+		std::vector<float> expected(count);
+		std::vector<float> actual(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			expected[i] = bf16ToFloat(floatToBF16(input[offset + i]));
+			actual[i] = bf16ToFloat(packed[offset + i]);
+		}
+
+		suite.compare("convertToBF16" + path + " count " + std::to_string(count), expected.data(), actual.data(), count, 0.0);
+
+		std::vector<float> unpacked(count + offset);
+		convertToFloat(packed.data() + offset, unpacked.data() + offset, count);
+		suite.compare("convertToFloat" + path + " count " + std::to_string(count), actual.data(), unpacked.data() + offset, count, 0.0);
+	}
+}
+
+/**
+ * Every inference algorithm against the batched training path
+*/
+static void testConvAlgorithms(TestSuite& suite, std::mt19937& generator)
+{
+	struct Case
+	{
+		ConvLayerDesc desc;
+		ConvShape inputShape;
+	};
+
+	const Case cases[] = {
+		{ ConvLayerDesc(4, 3, FUNC_RELU, POOL_MAX, 2), ConvShape(1, 8, 8) },
+		{ ConvLayerDesc(3, 3, FUNC_TANH, POOL_NONE), ConvShape(2, 7, 9) },
+		{ ConvLayerDesc(5, 3, FUNC_SIGMOID, POOL_AVERAGE, 2, 1, 0), ConvShape(3, 11, 6) },
+		{ ConvLayerDesc(2, 5, FUNC_LEAKY_RELU, POOL_NONE, 1, 2), ConvShape(2, 9, 9) },
+		{ ConvLayerDesc(3, 1, FUNC_GELU, POOL_MAX, 3), ConvShape(4, 6, 7) }
+	};
+
+	const ConvAlgorithm algorithms[] = { CONV_IM2COL, CONV_DIRECT, CONV_WINOGRAD };
+	const char* algorithmNames[] = { "im2col", "direct", "winograd" };
+
+	for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+	{
+		for(int a = 0; a < 3; ++a)
+		{
+			ConvLayerDesc desc = cases[c].desc;
+			if(algorithms[a] == CONV_WINOGRAD && (desc.kernelSize != 3 || desc.stride != 1))
+			{
+				continue;
+			}
+
+			desc.algorithm = algorithms[a];
+
+			ConvLayer layer(desc, cases[c].inputShape);
+			layer.initWeights(INIT_AUTO, 400 + c);
+			fillRandom(layer.getBiases().getData(), desc.numFilters, generator, -0.5f, 0.5f);
+
+			const int numExamples = 3;
+			const int inputSize = cases[c].inputShape.size();
+			const int outputSize = layer.getOutputShape().size();
+
+			std::vector<float> expected(outputSize * numExamples);
+			std::vector<float> actual(outputSize * numExamples);
+			std::vector<float> example(inputSize);
+			std::vector<float> scratch(layer.getScratchSize());
+
+			//The second round checks that a weight update reaches the precomputed Winograd kernels
+			for(int round = 0; round < 2; ++round)
+			{
+				if(round == 1)
+				{
+					ConvGradients gradients;
+					gradients.weights = randomMatrix(layer.getWeights().getRows(), layer.getWeights().getColumns(), generator);
+					gradients.biases = randomMatrix(desc.numFilters, 1, generator);
+					layer.applyGradients(gradients, 0.1f);
+				}
+
+				Matrix input = randomMatrix(inputSize, numExamples, generator);
+				Matrix batched = layer.calculateAcitvations(input, nullptr);
+
+				for(int e = 0; e < numExamples; ++e)
+				{
+					for(int i = 0; i < inputSize; ++i)
+					{
+						example[i] = input.getValue(i, e);
+					}
+
+					layer.forwardExample(example.data(), actual.data() + e * outputSize, scratch.data());
+
+					for(int i = 0; i < outputSize; ++i)
+					{
+						expected[e * outputSize + i] = batched.getValue(i, e);
+					}
+				}
+
+				std::string name = "conv case " + std::to_string(c) + " " + algorithmNames[a] + (round == 1 ? " after update" : "");
+				suite.compare(name, expected.data(), actual.data(), expected.size(), 1e-5);
+			}
+		}
+	}
+}
+
+/**
+ * Block-CSR kernels against the dense reference, with unstructured and whole-block
+ * sparsity and column counts that leave a shifted last block
+*/
+static void testSparseKernels(TestSuite& suite, std::mt19937& generator)
+{
+	for(int test = 0; test < 16; ++test)
+	{
+		int rows = randomInt(generator, 1, 37);
+		int columns = randomInt(generator, BlockSparseMatrix::BLOCK_COLUMNS, 45);
+		int count = randomInt(generator, 1, 13);
+		bool blockSparse = (test % 2) == 1;
+
+		std::vector<float> weights(rows * columns);
+		fillRandom(weights.data(), weights.size(), generator);
+
+		for(int i = 0; i < rows; ++i)
+		{
+			for(int j = 0; j < columns; ++j)
+			{
+				int cell = blockSparse ? (i / BlockSparseMatrix::BLOCK_ROWS) * 7 + j / BlockSparseMatrix::BLOCK_COLUMNS : i * columns + j;
+				if((cell * 2654435761u + test) % 10 < 7)
+				{
+					weights[i * columns + j] = 0.0f;
+				}
+			}
+		}
+
+		std::vector<float> biases(rows);
+		std::vector<float> input(columns * count);
+		fillRandom(biases.data(), rows, generator);
+		fillRandom(input.data(), input.size(), generator);
+
+		std::vector<float> expected(rows * count);
+		referenceMultiply(weights.data(), input.data(), expected.data(), rows, columns, count);
+		for(int i = 0; i < rows * count; ++i)
+		{
+			expected[i] += biases[i / count];
+		}
+
+		BlockSparseMatrix sparse(weights.data(), rows, columns);
+		std::string name = shapeName(blockSparse ? "block sparse" : "sparse", rows, columns);
+
+		std::vector<float> output(rows * count);
+		sparse.multiply(input.data(), biases.data(), output.data(), count);
+		suite.compare(name + " gemm x" + std::to_string(count), expected.data(), output.data(), rows * count, 1e-5);
+
+		//First example only, its inputs are every count-th value
+		std::vector<float> vectorInput(columns);
+		std::vector<float> vectorExpected(rows);
+		for(int j = 0; j < columns; ++j)
+		{
+			vectorInput[j] = input[j * count];
+		}
+
+		for(int i = 0; i < rows; ++i)
+		{
+			vectorExpected[i] = expected[i * count];
+		}
+
+		sparse.multiplyVector(vectorInput.data(), biases.data(), output.data());
+		suite.compare(name + (BlockSparseMatrix::hasVectorKernels() ? " gemv avx2" : " gemv"), vectorExpected.data(), output.data(), rows, 1e-5);
+	}
+}
+
+/**
+ * InferenceModel::forwardBatch against one forward call per example, for dense and pruned models
+*/
+static void testBatchedInference(TestSuite& suite, std::mt19937& generator)
+{
+	for(int pruned = 0; pruned < 2; ++pruned)
+	{
+		for(int conv = 0; conv < 2; ++conv)
+		{
+			std::vector<LayerDesc> layers = { LayerDesc(29, FUNC_RELU, 0.0f, true), LayerDesc(10, FUNC_SOFTMAX) };
+
+			CPUNeuralNet network = conv ? CPUNeuralNet(ConvShape(1, 8, 8), { ConvLayerDesc(4) }, layers, 7)
+				: CPUNeuralNet({ LayerDesc(64), layers[0], layers[1] }, 7);
+
+			if(pruned)
+			{
+				network.prune(0.8f, PRUNE_BLOCK);
+			}
+
+			std::shared_ptr<const InferenceModel> model = network.exportModel();
+
+			const int count = 11;
+			const int inputSize = model->getInputSize();
+			const int outputSize = model->getOutputSize();
+
+			std::vector<float> batchA(model->getMaxLayerSize() * count);
+			std::vector<float> batchB(model->getMaxLayerSize() * count);
+			std::vector<float> scratchA(model->getMaxLayerSize());
+			std::vector<float> scratchB(model->getMaxLayerSize());
+			std::vector<float> convScratch(model->getConvScratchSize());
+
+			fillRandom(batchA.data(), inputSize * count, generator, 0.0f, 1.0f);
+
+			std::vector<float> expected(outputSize * count);
+			for(int e = 0; e < count; ++e)
+			{
+				for(int i = 0; i < inputSize; ++i)
+				{
+					scratchA[i] = batchA[i * count + e];
+				}
+
+				const float* outputs = model->forward(scratchA.data(), scratchB.data(), convScratch.data());
+				for(int i = 0; i < outputSize; ++i)
+				{
+					expected[i * count + e] = outputs[i];
+				}
+			}
+
+			const float* outputs = model->forwardBatch(batchA.data(), batchB.data(), count, scratchA.data(), scratchB.data(), convScratch.data());
+
+			std::string name = std::string("forwardBatch") + (conv ? " conv" : "") + (pruned ? " pruned" : " dense");
+			suite.check(name + " uses sparse layers", (model->getNumSparseLayers() > 0) == (pruned == 1));
+			suite.compare(name, expected.data(), outputs, outputSize * count, 1e-5);
+		}
+	}
+}
+
+/**
+ * The exported model, with batch normalization folded into the weights, against the training
+ * forward pass through CPUNeuralNet::test, and classifyBatch against per-example classify
+*/
+static void testExportedClassification(TestSuite& suite, std::mt19937& generator)
+{
+	const int numImages = 200;
+	const int numChecked = 57;
+
+	//Label by the brighter half, so training moves the batch norm statistics away from their start
+	std::vector<byte> images(numImages * 64);
+	std::vector<byte> labels(numImages);
+	for(int i = 0; i < numImages; ++i)
+	{
+		int sum = 0;
+		for(int j = 0; j < 64; ++j)
+		{
+			images[i * 64 + j] = (byte)randomInt(generator, 0, 255);
+			sum += (j < 32) ? images[i * 64 + j] : -images[i * 64 + j];
+		}
+
+		labels[i] = (byte)((sum > 0) ? 1 : 0) + 2 * (images[i * 64] > 127);
+	}
+
+	for(int conv = 0; conv < 2; ++conv)
+	{
+		std::vector<LayerDesc> layers = { LayerDesc(24, FUNC_RELU, 0.2f, true), LayerDesc(4, FUNC_SOFTMAX) };
+
+		CPUNeuralNet network = conv ? CPUNeuralNet(ConvShape(1, 8, 8), { ConvLayerDesc(3) }, layers, 11)
+			: CPUNeuralNet({ LayerDesc(64), layers[0], layers[1] }, 11);
+
+		network.loadImageData(images.data(), 8, 8, numImages);
+		network.loadLabelData(labels.data(), numImages);
+		network.train(3, 20, 0.05f);
+
+		InferenceContext context(network.exportModel());
+
+		std::vector<int> batchLabels(numChecked);
+		context.classifyBatch(images.data(), numChecked, batchLabels.data());
+
+		int numTrainingMismatches = 0;
+		int numBatchMismatches = 0;
+		for(int i = 0; i < numChecked; ++i)
+		{
+			int label = context.classify(&images[i * 64]);
+
+			numTrainingMismatches += (label != network.test(&images[i * 64])) ? 1 : 0;
+			numBatchMismatches += (label != batchLabels[i]) ? 1 : 0;
+		}
+
+		std::string name = conv ? "exported conv model" : "exported model";
+		suite.check(name + " classify matches test", numTrainingMismatches == 0);
+		suite.check(name + " classifyBatch matches classify", numBatchMismatches == 0);
+	}
+}
+
+/**
+ * Mean natural-log cross-entropy of an exported model over the first count images
+*/
+static float exportedCost(CPUNeuralNet& network, const std::vector<byte>& images, const std::vector<byte>& labels, int imageSize, int count)
+{
+	InferenceContext context(network.exportModel());
+
+	double cost = 0.0;
+	for(int i = 0; i < count; ++i)
+	{
+		context.classify(&images[(size_t)i * imageSize]);
+		cost -= std::log(std::max((double)context.getOutputs()[labels[i]], 1e-7));
+	}
+
+	return (float)(cost / count);
+}
+
+/**
+ * Trains the same network from the same seed in fp32 and in bf16 mixed precision. Rounding the
+ * stored activations perturbs every step a little, so the final costs must agree closely
+ * while both fall well below the cost of the untrained network.
+*/
+static void testMixedPrecisionParity(TestSuite& suite, std::mt19937& generator)
+{
+	const int numImages = 400;
+
+	std::vector<byte> images(numImages * 64);
+	std::vector<byte> labels(numImages);
+	for(int i = 0; i < numImages; ++i)
+	{
+		int sum = 0;
+		for(int j = 0; j < 64; ++j)
+		{
+			images[i * 64 + j] = (byte)randomInt(generator, 0, 255);
+			sum += (j < 32) ? images[i * 64 + j] : -images[i * 64 + j];
+		}
+
+		labels[i] = (byte)((sum > 0) ? 1 : 0) + 2 * (images[i * 64] > 127);
+	}
+
+	for(int conv = 0; conv < 2; ++conv)
+	{
+		std::vector<LayerDesc> layers = { LayerDesc(32, FUNC_RELU, 0.0f, true), LayerDesc(4, FUNC_SOFTMAX) };
+
+		float initialCost = 0.0f;
+		float finalCosts[2] = {};
+
+		for(int mixed = 0; mixed < 2; ++mixed)
+		{
+			CPUNeuralNet network = conv ? CPUNeuralNet(ConvShape(1, 8, 8), { ConvLayerDesc(3) }, layers, 23)
+				: CPUNeuralNet({ LayerDesc(64), layers[0], layers[1] }, 23);
+
+			network.setMixedPrecision(mixed == 1);
+			network.loadImageData(images.data(), 8, 8, numImages);
+			network.loadLabelData(labels.data(), numImages);
+
+			initialCost = exportedCost(network, images, labels, 64, numImages);
+			network.train(8, 20, 0.05f);
+			finalCosts[mixed] = exportedCost(network, images, labels, 64, numImages);
+		}
+
+		std::string name = conv ? "bf16 conv training" : "bf16 training";
+		suite.check(name + " learns", finalCosts[1] < 0.7f * initialCost);
+		suite.compare(name + " final cost matches fp32", &finalCosts[0], &finalCosts[1], 1, 0.02);
+	}
+}
+
+int main()
+{
+	TestSuite suite;
+	std::mt19937 generator(12345);
+
+	testDot(suite, generator);
+	testUnalignedMultiply(suite, generator);
+	testTranspose(suite, generator);
+	testBroadcast(suite, generator);
+	testScalarOperators(suite, generator);
+	testReductions(suite, generator);
+	testAddScaled(suite, generator);
+	testFillUniform(suite, generator);
+	testBFloat16(suite, generator);
+	testConvAlgorithms(suite, generator);
+	testSparseKernels(suite, generator);
+	testBatchedInference(suite, generator);
+	testExportedClassification(suite, generator);
+	testMixedPrecisionParity(suite, generator);
+
+	return suite.finish();
+}
\ No newline at end of file
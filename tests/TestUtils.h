@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <random>
+#include <algorithm>
+
+/**
+ * Minimal check collector, every comparison prints its worst deviation so tolerance
+ * changes can be judged from the test log
+*/
+class TestSuite
+{
+private:
+	int m_numChecks = 0;
+	int m_numFailures = 0;
+public:
+	/**
+	 * Element i passes when |expected - actual| <= tolerance * max(1, |expected|).
+	 * NaN only matches NaN.
+	*/
+	bool compare(const std::string& name, const float* expected, const float* actual, size_t count, double tolerance)
+	{
+		double maxError = 0.0;
+		double maxAbsoluteError = 0.0;
+		size_t worstIndex = 0;
+
+		for(size_t i = 0; i < count; ++i)
+		{
+			double error;
+			double absoluteError;
+
+			if(std::isnan(expected[i]) || std::isnan(actual[i]))
+			{
+				absoluteError = error = (std::isnan(expected[i]) && std::isnan(actual[i])) ? 0.0 : INFINITY;
+			}
+			else if(expected[i] == actual[i])
+			{
+				absoluteError = error = 0.0;
+			}
+			else
+			{
+				absoluteError = std::fabs((double)expected[i] - actual[i]);
+				error = absoluteError / std::max(1.0, std::fabs((double)expected[i]));
+			}
+
+			if(error > maxError)
+			{
+				maxError = error;
+				worstIndex = i;
+			}
+
+			maxAbsoluteError = std::max(maxAbsoluteError, absoluteError);
+		}
+
+		bool passed = maxError <= tolerance;
+
+		++m_numChecks;
+		printf("%s %-48s max error %.3e (abs %.3e, tolerance %.1e) over %zu values\n",
+			passed ? "[PASS]" : "[FAIL]", name.c_str(), maxError, maxAbsoluteError, tolerance, count);
+
+		if(!passed)
+		{
+			++m_numFailures;
+			printf("       worst at %zu: expected %.8g, got %.8g\n", worstIndex, expected[worstIndex], actual[worstIndex]);
+		}
+
+		return passed;
+	}
+
+	bool check(const std::string& name, bool condition)
+	{
+		++m_numChecks;
+		printf("%s %s\n", condition ? "[PASS]" : "[FAIL]", name.c_str());
+
+		if(!condition)
+		{
+			++m_numFailures;
+		}
+
+		return condition;
+	}
+
+	/**
+	 * Prints the summary and returns the process exit code
+	*/
+	int finish() const
+	{
+		printf("%d of %d checks passed\n", m_numChecks - m_numFailures, m_numChecks);
+		return m_numFailures == 0 ? 0 : 1;
+	}
+};
+
+inline void fillRandom(float* data, size_t count, std::mt19937& generator, float low = -1.0f, float high = 1.0f)
+{
+	std::uniform_real_distribution<float> distribution(low, high);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		data[i] = distribution(generator);
+	}
+}
+
+inline int randomInt(std::mt19937& generator, int low, int high)
+{
+	return std::uniform_int_distribution<int>(low, high)(generator);
+}
\ No newline at end of file